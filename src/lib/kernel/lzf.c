@@ -0,0 +1,192 @@
+/* LZF compression.
+
+   Compressed data is a sequence of runs, each introduced by a
+   control byte C:
+
+     - If C < 32, it is followed by C + 1 literal bytes.
+
+     - Otherwise, it is a back-reference: the top 3 bits of C
+       hold a length L, and if L is 7, the next byte is added to
+       it.  The low 5 bits of C and the byte after that hold an
+       offset O.  The run repeats the L + 2 bytes that start O + 1
+       bytes back in the output, which may overlap the run
+       itself.
+
+   The compressor finds back-references through a hash table of
+   the positions at which each 3-byte sequence last occurred. */
+
+#include "lzf.h"
+#include <debug.h>
+#include <string.h>
+
+/* Longest literal run. */
+#define MAX_LIT 32
+
+/* Longest back-reference, in bytes. */
+#define MAX_REF_LEN (7 + 255 + 2)
+
+/* Farthest back-reference, in bytes.  Offsets are stored in 13
+   bits, and table entries in 16. */
+#define MAX_REF_OFS (1 << 13)
+
+static unsigned hash3 (const uint8_t *);
+
+/* Compresses the SRC_SIZE bytes at SRC into the DST_SIZE bytes
+   at DST, using WORK, which must be LZF_WORK_SIZE bytes, for
+   scratch space.  Returns the size of the compressed data, or 0
+   if it does not fit in DST_SIZE bytes.  SRC_SIZE must be less
+   than 65536. */
+size_t
+lzf_compress (const void *src_, size_t src_size,
+              void *dst_, size_t dst_size, void *work)
+{
+  const uint8_t *src = src_;
+  const uint8_t *ip = src;
+  const uint8_t *end = src + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + dst_size;
+  uint16_t *table = work;
+  uint8_t *lit;
+  size_t lit_cnt = 0;
+
+  ASSERT (src_size < 65536);
+
+  if (dst_size == 0)
+    return 0;
+  memset (table, 0, LZF_WORK_SIZE);
+
+  /* LIT is the control byte of the literal run in progress,
+     reserved before its first byte arrives. */
+  lit = op++;
+  while (ip < end)
+    {
+      if (ip + 2 < end)
+        {
+          unsigned h = hash3 (ip);
+          const uint8_t *ref = src + table[h];
+          size_t ofs = ip - ref;
+
+          table[h] = ip - src;
+          if (ofs > 0 && ofs <= MAX_REF_OFS
+              && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2])
+            {
+              size_t max_len = end - ip < MAX_REF_LEN ? end - ip : MAX_REF_LEN;
+              size_t len = 3;
+
+              while (len < max_len && ref[len] == ip[len])
+                len++;
+
+              /* End the literal run, or take back its control
+                 byte if it is empty. */
+              if (lit_cnt > 0)
+                *lit = lit_cnt - 1;
+              else
+                op--;
+
+              /* Back-reference, plus the next control byte. */
+              if (op_end - op < 4)
+                return 0;
+              len -= 2;
+              ofs--;
+              if (len < 7)
+                *op++ = (len << 5) | (ofs >> 8);
+              else
+                {
+                  *op++ = (7 << 5) | (ofs >> 8);
+                  *op++ = len - 7;
+                }
+              *op++ = ofs & 0xff;
+              ip += len + 2;
+
+              lit = op++;
+              lit_cnt = 0;
+              continue;
+            }
+        }
+
+      /* Literal byte. */
+      if (op >= op_end)
+        return 0;
+      *op++ = *ip++;
+      if (++lit_cnt == MAX_LIT)
+        {
+          *lit = MAX_LIT - 1;
+          if (op >= op_end)
+            return 0;
+          lit = op++;
+          lit_cnt = 0;
+        }
+    }
+
+  if (lit_cnt > 0)
+    *lit = lit_cnt - 1;
+  else
+    op--;
+  return op - dst;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, produced by
+   lzf_compress(), into the DST_SIZE bytes at DST.  Returns the
+   size of the decompressed data, or 0 if SRC is corrupt or its
+   data does not fit in DST_SIZE bytes. */
+size_t
+lzf_decompress (const void *src_, size_t src_size,
+                void *dst_, size_t dst_size)
+{
+  const uint8_t *ip = src_;
+  const uint8_t *end = ip + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + dst_size;
+
+  while (ip < end)
+    {
+      unsigned ctrl = *ip++;
+
+      if (ctrl < MAX_LIT)
+        {
+          size_t len = ctrl + 1;
+
+          if ((size_t) (end - ip) < len || (size_t) (op_end - op) < len)
+            return 0;
+          memcpy (op, ip, len);
+          ip += len;
+          op += len;
+        }
+      else
+        {
+          size_t len = ctrl >> 5;
+          size_t ofs;
+          const uint8_t *ref;
+
+          if (len == 7)
+            {
+              if (ip >= end)
+                return 0;
+              len += *ip++;
+            }
+          if (ip >= end)
+            return 0;
+          ofs = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+          len += 2;
+          if (ofs > (size_t) (op - dst) || (size_t) (op_end - op) < len)
+            return 0;
+
+          /* Copy a byte at a time, since the source may overlap
+             the destination. */
+          for (ref = op - ofs; len > 0; len--)
+            *op++ = *ref++;
+        }
+    }
+
+  return op - dst;
+}
+
+/* Returns a hash of the 3 bytes at P. */
+static unsigned
+hash3 (const uint8_t *p)
+{
+  uint32_t x = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (x * 2654435761u) >> (32 - LZF_HASH_BITS);
+}
@@ -0,0 +1,25 @@
+#ifndef __LIB_KERNEL_LZF_H
+#define __LIB_KERNEL_LZF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* LZF compression.
+
+   A small, fast member of the LZ77 family, in the format of Marc
+   Lehmann's liblzf.  It trades compression ratio for speed,
+   which suits data such as evicted pages that are compressed
+   once and decompressed at most a few times. */
+
+/* Number of bits in the compressor's hash. */
+#define LZF_HASH_BITS 12
+
+/* Size of the work area that lzf_compress() needs, in bytes. */
+#define LZF_WORK_SIZE ((1u << LZF_HASH_BITS) * sizeof (uint16_t))
+
+size_t lzf_compress (const void *src, size_t src_size,
+                     void *dst, size_t dst_size, void *work);
+size_t lzf_decompress (const void *src, size_t src_size,
+                       void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lzf.h */
@@ -0,0 +1,51 @@
+/* Allocates and frees 100,000 single pages, first one at a time
+   and then in bursts large enough to overflow the page
+   magazine, and reports the timer ticks that each pattern
+   takes.  Pages handed out together must be distinct. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "devices/timer.h"
+
+/* Total pages to allocate and free in each pattern. */
+#define PAGE_CNT 100000
+
+/* Pages held at once in the burst pattern. */
+#define BURST_CNT 64
+
+void
+test_palloc_churn (void) 
+{
+  static uint32_t *pages[BURST_CNT];
+  int64_t start;
+  int i, j;
+
+  start = timer_ticks ();
+  for (i = 0; i < PAGE_CNT; i++)
+    palloc_free_page (palloc_get_page (PAL_ASSERT));
+  msg ("%d one-at-a-time allocations: %"PRId64" ticks",
+       PAGE_CNT, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; i < PAGE_CNT / BURST_CNT; i++) 
+    {
+      for (j = 0; j < BURST_CNT; j++) 
+        {
+          pages[j] = palloc_get_page (PAL_ASSERT);
+          *pages[j] = j;
+        }
+      for (j = 0; j < BURST_CNT; j++) 
+        {
+          if (*pages[j] != (uint32_t) j)
+            fail ("page %d of burst %d was handed out twice", j, i);
+          palloc_free_page (pages[j]);
+        }
+    }
+  msg ("%d allocations in bursts of %d: %"PRId64" ticks",
+       PAGE_CNT / BURST_CNT * BURST_CNT, BURST_CNT, timer_elapsed (start));
+
+  pass ();
+}
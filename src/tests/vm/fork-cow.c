@@ -0,0 +1,50 @@
+/* Fills a large buffer with random data and forks.  The child
+   checks that it sees the same data and then overwrites all of
+   it, while the parent overwrites the first half of its own
+   copy.  Neither process may see the other's writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/cksum.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  unsigned long whole_sum, tail_sum;
+  struct arc4 arc4;
+  pid_t child;
+  size_t i;
+
+  arc4_init (&arc4, "fork-cow", 8);
+  arc4_crypt (&arc4, buf, SIZE);
+  whole_sum = cksum (buf, SIZE);
+  tail_sum = cksum (buf + SIZE / 2, SIZE / 2);
+
+  msg ("fork");
+  child = fork ();
+  if (child == 0)
+    {
+      if (cksum (buf, SIZE) != whole_sum)
+        fail ("child sees wrong data");
+      memset (buf, 0x5a, SIZE);
+      exit (81);
+    }
+  if (child == -1)
+    fail ("fork failed");
+
+  memset (buf, 0xa5, SIZE / 2);
+  CHECK (wait (child) == 81, "wait for child");
+  for (i = 0; i < SIZE / 2; i++)
+    if (buf[i] != (char) 0xa5)
+      fail ("byte %zu of first half is %02hhx", i, buf[i]);
+  if (cksum (buf + SIZE / 2, SIZE / 2) != tail_sum)
+    fail ("second half changed");
+  msg ("parent's data intact");
+}
@@ -0,0 +1,61 @@
+/* Writes a 256 kB file, then scans it once with read() and once
+   through a memory mapping, and verifies that both scans see the
+   same data.  Comparing the kernel's page fault and disk
+   statistics for the two scans shows the cost of copying file
+   data through read(). */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/cksum.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (256 * 1024)
+#define CHUNK 4096
+
+static char buf[CHUNK];
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  unsigned long read_sum = 0, mmap_sum = 0;
+  struct arc4 arc4;
+  int handle;
+  mapid_t map;
+  size_t ofs;
+
+  CHECK (create ("scan", SIZE), "create \"scan\"");
+  CHECK ((handle = open ("scan")) > 1, "open \"scan\"");
+
+  msg ("write \"scan\"");
+  arc4_init (&arc4, "mmap-scan", 9);
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    {
+      memset (buf, 0, CHUNK);
+      arc4_crypt (&arc4, buf, CHUNK);
+      if (write (handle, buf, CHUNK) != CHUNK)
+        fail ("write of \"scan\" failed at offset %zu", ofs);
+    }
+
+  msg ("scan with read()");
+  seek (handle, 0);
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    {
+      if (read (handle, buf, CHUNK) != CHUNK)
+        fail ("read of \"scan\" failed at offset %zu", ofs);
+      read_sum += cksum (buf, CHUNK);
+    }
+
+  CHECK ((map = mmap (handle, actual)) != MAP_FAILED, "mmap \"scan\"");
+  msg ("scan with mmap");
+  for (ofs = 0; ofs < SIZE; ofs += CHUNK)
+    mmap_sum += cksum (actual + ofs, CHUNK);
+  munmap (map);
+
+  if (read_sum != mmap_sum)
+    fail ("read() and mmap scans differ");
+  msg ("scans match");
+  close (handle);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-scan) begin
+(mmap-scan) create "scan"
+(mmap-scan) open "scan"
+(mmap-scan) write "scan"
+(mmap-scan) scan with read()
+(mmap-scan) mmap "scan"
+(mmap-scan) scan with mmap
+(mmap-scan) scans match
+(mmap-scan) end
+EOF
+pass;
@@ -0,0 +1,81 @@
+/* Loops over a small "hot" set of pages while also scanning a
+   buffer bigger than physical memory, first in short stretches
+   between passes over the hot set and then in one long sweep,
+   and checks that every page keeps its contents.
+
+   This is a benchmark for the page replacement policies as well
+   as a test: run it with -vm-policy=clock, 2q, and arc and
+   compare the fault counts that the kernel prints when it powers
+   off.  A policy that resists scans keeps the hot set resident
+   through the long sweeps. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+#define HOT_PAGES 64
+#define SCAN_PAGES 768
+#define CHUNK_PAGES 64
+#define ROUNDS 3
+
+static char hot[HOT_PAGES * PAGE];
+static char scan[SCAN_PAGES * PAGE];
+
+/* Checks that each of the PAGE_CNT pages of BUF starting at
+   page FIRST starts with its page number plus TAG. */
+static void
+check_pages (const char *buf, size_t first, size_t page_cnt, int tag) 
+{
+  size_t i;
+
+  for (i = first; i < first + page_cnt; i++)
+    {
+      int value;
+
+      memcpy (&value, buf + i * PAGE, sizeof value);
+      if (value != (int) i + tag)
+        fail ("page %zu holds %d, expected %d", i, value, (int) i + tag);
+    }
+}
+
+/* Stores each page's page number plus TAG at the start of each
+   of the PAGE_CNT pages in BUF. */
+static void
+fill_pages (char *buf, size_t page_cnt, int tag) 
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      int value = i + tag;
+      memcpy (buf + i * PAGE, &value, sizeof value);
+    }
+}
+
+void
+test_main (void)
+{
+  int round;
+
+  msg ("fill pages");
+  fill_pages (hot, HOT_PAGES, 1000);
+  fill_pages (scan, SCAN_PAGES, 5000);
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      size_t chunk;
+
+      msg ("round %d: scan in stretches", round);
+      for (chunk = 0; chunk < SCAN_PAGES; chunk += CHUNK_PAGES)
+        {
+          check_pages (hot, 0, HOT_PAGES, 1000);
+          check_pages (scan, chunk, CHUNK_PAGES, 5000);
+        }
+
+      msg ("round %d: long sweep", round);
+      check_pages (hot, 0, HOT_PAGES, 1000);
+      check_pages (scan, 0, SCAN_PAGES, 5000);
+      check_pages (hot, 0, HOT_PAGES, 1000);
+    }
+}
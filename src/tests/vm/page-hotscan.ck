@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-hotscan) begin
+(page-hotscan) fill pages
+(page-hotscan) round 0: scan in stretches
+(page-hotscan) round 0: long sweep
+(page-hotscan) round 1: scan in stretches
+(page-hotscan) round 1: long sweep
+(page-hotscan) round 2: scan in stretches
+(page-hotscan) round 2: long sweep
+(page-hotscan) end
+EOF
+pass;
@@ -0,0 +1,37 @@
+/* Reads every page of a large BSS array, which must read as
+   zeros, then writes to some of the pages and checks that the
+   writes went to those pages only. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PAGE 4096
+#define STRIDE 16
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  msg ("read pages");
+  for (i = 0; i < SIZE; i += PAGE)
+    if (buf[i] != 0 || buf[i + PAGE - 1] != 0)
+      fail ("page at offset %zu is not zeroed", i);
+
+  msg ("write every %dth page", STRIDE);
+  for (i = 0; i < SIZE; i += PAGE * STRIDE)
+    memset (buf + i, i / PAGE + 1, PAGE);
+
+  msg ("check pages");
+  for (i = 0; i < SIZE; i += PAGE)
+    {
+      char expected = i % (PAGE * STRIDE) == 0 ? (char) (i / PAGE + 1) : 0;
+      if (buf[i] != expected || buf[i + PAGE - 1] != expected)
+        fail ("page at offset %zu holds %d, expected %d",
+              i, buf[i], expected);
+    }
+}
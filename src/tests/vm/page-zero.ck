@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zero) begin
+(page-zero) read pages
+(page-zero) write every 16th page
+(page-zero) check pages
+(page-zero) end
+EOF
+pass;
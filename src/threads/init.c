@@ -21,6 +21,7 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -37,6 +38,12 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/policy.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -62,6 +69,10 @@ static void paging_init (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+static enum palloc_lend_policy parse_lend_policy (const char *);
+#ifdef VM
+static const struct frame_policy *parse_vm_policy (const char *);
+#endif
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -127,6 +138,13 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init ();
+  page_init ();
+  swap_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -150,15 +168,50 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID feature flags (leaf 1, EDX). */
+#define CPUID_PSE 0x00000008    /* Page Size Extension (4 MB pages). */
+#define CPUID_PGE 0x00002000    /* Page Global Enable. */
+
+/* Control register 4 bits. */
+#define CR4_PSE 0x00000010      /* Page Size Extension. */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+
+/* Returns the feature flags that CPUID reports in EDX. */
+static uint32_t
+cpu_features (void) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports 4 MB pages, every 4 MB region that lies
+   entirely within RAM and contains no kernel text is mapped by a
+   single page directory entry.  This saves a page table page per
+   region and covers it with a single TLB entry.  The region
+   holding the kernel text keeps 4 kB pages so that the text can
+   stay read-only.
+
+   If the CPU supports global pages, the kernel mappings are
+   marked global.  Every page directory shares them, so they stay
+   valid across the CR3 reload on each process switch, which then
+   flushes only user translations from the TLB. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
+  size_t large_cnt = 0;
+  uint32_t features = cpu_features ();
+  bool pse = (features & CPUID_PSE) != 0;
+  bool pge = (features & CPUID_PGE) != 0;
+  uint32_t global = pge ? PTE_G : 0;
+  uint32_t cr4;
   extern char _start, _end_kernel_text;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -173,13 +226,37 @@ paging_init (void)
 
       if (pd[pde_idx] == 0)
         {
+          if (pse && pte_idx == 0
+              && page + PTSPAN / PGSIZE <= init_ram_pages
+              && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+            {
+              pd[pde_idx] = pde_create_kernel_large (vaddr) | global;
+              page += PTSPAN / PGSIZE - 1;
+              large_cnt++;
+              continue;
+            }
+
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
+  /* Large pages in a page directory are honored only with
+     CR4.PSE set.  The page tables the loader built use none, so
+     turning it on before switching to ours is harmless.  Global
+     bits likewise take effect only with CR4.PGE set. */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (pse)
+    cr4 |= CR4_PSE;
+  if (pge)
+    cr4 |= CR4_PGE;
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+  if (large_cnt > 0)
+    printf ("Mapped %zu MB with 4 MB pages, saving %zu page table pages.\n",
+            large_cnt * (PTSPAN >> 20), large_cnt);
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -256,9 +333,23 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-mstat"))
+        malloc_accounting = true;
+      else if (!strcmp (name, "-lend"))
+        palloc_lend_policy = parse_lend_policy (value);
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-stack"))
+        page_stack_limit = (size_t) atoi (value) * 1024;
+      else if (!strcmp (name, "-pageout"))
+        frame_pageout_pct = atoi (value);
+      else if (!strcmp (name, "-vm-policy"))
+        frame_policy = parse_vm_policy (value);
+      else if (!strcmp (name, "-swap-cache"))
+        swap_cache_limit = (size_t) atoi (value) * 1024;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -277,6 +368,40 @@ parse_options (char **argv)
   return argv;
 }
 
+/* Parses VALUE, the argument to the "-lend" option. */
+static enum palloc_lend_policy
+parse_lend_policy (const char *value) 
+{
+  if (value == NULL)
+    PANIC ("option `-lend' requires an argument (use -h for help)");
+  else if (!strcmp (value, "none"))
+    return LEND_NONE;
+  else if (!strcmp (value, "kernel"))
+    return LEND_TO_KERNEL;
+  else if (!strcmp (value, "user"))
+    return LEND_TO_USER;
+  else if (!strcmp (value, "both"))
+    return LEND_BOTH;
+  else
+    PANIC ("unknown lending policy `%s' (use -h for help)", value);
+}
+
+#ifdef VM
+/* Parses VALUE, the argument to the "-vm-policy" option. */
+static const struct frame_policy *
+parse_vm_policy (const char *value) 
+{
+  const struct frame_policy *policy;
+
+  if (value == NULL)
+    PANIC ("option `-vm-policy' requires an argument (use -h for help)");
+  policy = policy_lookup (value);
+  if (policy == NULL)
+    PANIC ("unknown replacement policy `%s' (use -h for help)", value);
+  return policy;
+}
+#endif
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv)
@@ -292,6 +417,15 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+/* Prints kernel memory usage. */
+static void
+run_memstat (char **argv UNUSED) 
+{
+  palloc_print_stats ();
+  malloc_print_stats ();
+  kmem_print_stats ();
+}
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -309,6 +443,7 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"memstat", 1, run_memstat},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -357,6 +492,7 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  memstat            Print kernel memory usage.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
@@ -379,8 +515,20 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -mstat             Track kernel memory by allocation site.\n"
+          "  -lend=POLICY       Let none, kernel, user, or both page pools\n"
+          "                     borrow from the other (default: user).\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -stack=SIZE        Let user stacks grow to SIZE kB (default: 8192).\n"
+          "  -pageout=PCT       Evict pages in the background when less than\n"
+          "                     PCT%% of user memory is free (default: 3).\n"
+          "  -vm-policy=POLICY  Replace pages with the clock, 2q, or arc\n"
+          "                     policy (default: clock).\n"
+          "  -swap-cache=SIZE   Keep up to SIZE kB of compressed swapped-out\n"
+          "                     pages in memory (default: 0).\n"
 #endif
           );
   shutdown_power_off ();
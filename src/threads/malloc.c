@@ -4,18 +4,22 @@
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   The size of each request, in bytes, is rounded up to the
+   nearest size class and assigned to the "descriptor" that
+   manages blocks of that size.  Size classes grow by roughly
+   25% at a time, so internal fragmentation stays below about
+   20%, instead of approaching 50% as with powers of 2.  The
+   descriptor keeps a list of free blocks.  If the free list is
+   nonempty, one of its blocks is used to satisfy the request.
 
    Otherwise, a new page of memory, called an "arena", is
    obtained from the page allocator (if none is available,
@@ -26,13 +30,30 @@
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   and give the arena back to the page allocator.  To keep a
+   block that is repeatedly allocated and freed from making us
+   obtain and release a page each time, each descriptor holds on
+   to up to EMPTY_ARENA_MAX empty arenas before doing so.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   If malloc_accounting is set, which the "-mstat" kernel option
+   does before malloc_init() is called, every block also carries
+   a hidden header just before the pointer returned to the
+   caller.  The header records the requested size and the call
+   site, identified by return address, so that live bytes can be
+   charged to the code that allocated them. */
+
+/* Track live bytes per call site?
+   Must not change once malloc_init() has been called. */
+bool malloc_accounting;
+
+/* Empty arenas kept by each descriptor. */
+#define EMPTY_ARENA_MAX 1
 
 /* Descriptor. */
 struct desc
@@ -40,7 +61,16 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t empty_cnt;           /* Empty arenas on free list. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics. */
+    size_t live_cnt;            /* Blocks currently allocated. */
+    long long alloc_cnt;        /* Blocks allocated. */
+    long long req_bytes;        /* Bytes requested by those. */
+    long long arena_get_cnt;    /* Arenas obtained from palloc. */
+    long long arena_free_cnt;   /* Arenas returned to palloc. */
+    long long arena_keep_cnt;   /* Empty arenas kept instead. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -61,9 +91,52 @@ struct block
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[32];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Big block statistics. */
+static long long big_alloc_cnt; /* Big blocks allocated. */
+static long long big_req_bytes; /* Bytes requested by those. */
+static long long big_bytes;     /* Bytes in pages allocated for them. */
+static size_t big_live_cnt;     /* Big blocks currently allocated. */
+
+/* realloc() statistics. */
+static long long realloc_inplace_cnt; /* Resized without moving. */
+static long long realloc_move_cnt;    /* Moved to a new block. */
+
+/* A call site that allocates memory, with malloc_accounting. */
+struct site
+  {
+    void *pc;                   /* Return address of the call. */
+    size_t live_cnt;            /* Blocks currently allocated. */
+    size_t live_bytes;          /* Bytes currently allocated. */
+    size_t peak_bytes;          /* Maximum value of live_bytes. */
+    long long alloc_cnt;        /* Blocks allocated. */
+  };
+
+/* Hash table of call sites, with linear probing.  Sites that
+   don't fit are lumped together in overflow_site. */
+#define SITE_CNT 256            /* Power of 2. */
+static struct site sites[SITE_CNT];
+static struct site overflow_site;
+
+/* Hidden header at the start of each block, with
+   malloc_accounting. */
+struct alloc_hdr
+  {
+    struct site *site;          /* Call site that allocated it. */
+    size_t size;                /* Requested size in bytes. */
+  };
+
+static void *malloc_at (size_t size, void *pc);
+static void *block_alloc (size_t size);
+static void block_free (void *block);
+static size_t block_size (void *block);
+static struct site *site_charge (void *pc, size_t size);
+static void site_resize (struct site *, size_t old_size, size_t new_size);
+static int compare_sites (const void *, const void *);
+static struct desc *find_desc (size_t size);
+static bool resize_in_place (void *block, size_t new_size);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -71,16 +144,30 @@ static struct block *arena_to_block (struct arena *, size_t idx);
 void
 malloc_init (void) 
 {
+  const size_t arena_bytes = PGSIZE - sizeof (struct arena);
   size_t block_size;
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  for (block_size = 16; block_size < PGSIZE / 2;
+       block_size = ROUND_UP (block_size + block_size / 4, 8))
     {
       struct desc *d = &descs[desc_cnt++];
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      d->blocks_per_arena = arena_bytes / block_size;
+
+      /* Grow the block to the largest size that still fits as
+         many blocks in an arena, since the space would otherwise
+         go unused at the end of each arena. */
+      block_size = ROUND_DOWN (arena_bytes / d->blocks_per_arena, 8);
       d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
+      d->empty_cnt = 0;
       lock_init (&d->lock);
+      d->live_cnt = 0;
+      d->alloc_cnt = 0;
+      d->req_bytes = 0;
+      d->arena_get_cnt = 0;
+      d->arena_free_cnt = 0;
+      d->arena_keep_cnt = 0;
     }
 }
 
@@ -89,20 +176,46 @@ malloc_init (void)
 void *
 malloc (size_t size) 
 {
-  struct desc *d;
-  struct block *b;
-  struct arena *a;
+  return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Obtains and returns a new block of at least SIZE bytes on
+   behalf of the call site at PC.  Returns a null pointer if
+   memory is not available. */
+static void *
+malloc_at (size_t size, void *pc) 
+{
+  struct alloc_hdr *h;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
     return NULL;
 
-  /* Find the smallest descriptor that satisfies a SIZE-byte
-     request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
+  if (!malloc_accounting)
+    return block_alloc (size);
+
+  h = block_alloc (size + sizeof *h);
+  if (h == NULL)
+    return NULL;
+  h->site = site_charge (pc, size);
+  h->size = size;
+  return h + 1;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes, which
+   must be nonzero, from the size classes or, for large SIZE,
+   directly from the page allocator.  Returns a null pointer if
+   memory is not available. */
+static void *
+block_alloc (size_t size) 
+{
+  struct desc *d;
+  struct block *b;
+  struct arena *a;
+  enum intr_level old_level;
+
+  d = find_desc (size);
+  if (d == NULL) 
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
@@ -111,6 +224,13 @@ malloc (size_t size)
       if (a == NULL)
         return NULL;
 
+      old_level = intr_disable ();
+      big_live_cnt++;
+      big_alloc_cnt++;
+      big_req_bytes += size;
+      big_bytes += page_cnt * PGSIZE - sizeof *a;
+      intr_set_level (old_level);
+
       /* Initialize the arena to indicate a big block of PAGE_CNT
          pages, and return it. */
       a->magic = ARENA_MAGIC;
@@ -143,12 +263,21 @@ malloc (size_t size)
           struct block *b = arena_to_block (a, i);
           list_push_back (&d->free_list, &b->free_elem);
         }
+      d->arena_get_cnt++;
     }
 
   /* Get a block from free list and return it. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
-  a->free_cnt--;
+  if (a->free_cnt-- == d->blocks_per_arena && d->empty_cnt > 0)
+    {
+      /* An empty arena with blocks already on the free list is
+         one we kept around, not one fresh from palloc. */
+      d->empty_cnt--;
+    }
+  d->live_cnt++;
+  d->alloc_cnt++;
+  d->req_bytes += size;
   lock_release (&d->lock);
   return b;
 }
@@ -167,14 +296,15 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_at (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
   return p;
 }
 
-/* Returns the number of bytes allocated for BLOCK. */
+/* Returns the number of bytes allocated for BLOCK, a block
+   obtained from block_alloc(). */
 static size_t
 block_size (void *block) 
 {
@@ -190,24 +320,65 @@ block_size (void *block)
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK).
+   The block stays where it is if NEW_SIZE falls in its size
+   class, or if it is a big block whose pages can be trimmed or
+   extended in place. */
 void *
 realloc (void *old_block, size_t new_size) 
 {
+  void *pc = __builtin_return_address (0);
+  enum intr_level old_level;
+
   if (new_size == 0) 
     {
       free (old_block);
       return NULL;
     }
+  else if (old_block == NULL)
+    return malloc_at (new_size, pc);
   else 
     {
-      void *new_block = malloc (new_size);
-      if (old_block != NULL && new_block != NULL)
+      struct alloc_hdr *h = NULL;
+      void *block = old_block;
+      size_t hdr_size = 0;
+      size_t old_size;
+      void *new_block;
+
+      if (malloc_accounting)
+        {
+          h = (struct alloc_hdr *) old_block - 1;
+          block = h;
+          hdr_size = sizeof *h;
+          old_size = h->size;
+        }
+      else
+        old_size = block_size (old_block);
+
+      if (resize_in_place (block, new_size + hdr_size))
+        {
+          if (h != NULL)
+            {
+              site_resize (h->site, h->size, new_size);
+              h->size = new_size;
+            }
+
+          old_level = intr_disable ();
+          realloc_inplace_cnt++;
+          intr_set_level (old_level);
+          return old_block;
+        }
+
+      new_block = malloc_at (new_size, pc);
+      if (new_block != NULL)
         {
-          size_t old_size = block_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
           free (old_block);
+
+          old_level = intr_disable ();
+          realloc_move_cnt++;
+          intr_set_level (old_level);
         }
       return new_block;
     }
@@ -218,51 +389,232 @@ realloc (void *old_block, size_t new_size)
 void
 free (void *p) 
 {
-  if (p != NULL)
+  if (p != NULL && malloc_accounting)
     {
-      struct block *b = p;
-      struct arena *a = block_to_arena (b);
-      struct desc *d = a->desc;
+      struct alloc_hdr *h = (struct alloc_hdr *) p - 1;
+      site_resize (h->site, h->size, 0);
+      block_free (h);
+    }
+  else if (p != NULL)
+    block_free (p);
+}
+
+/* Frees BLOCK, which must have been obtained from
+   block_alloc(). */
+static void
+block_free (void *block) 
+{
+  struct block *b = block;
+  struct arena *a = block_to_arena (b);
+  struct desc *d = a->desc;
       
-      if (d != NULL) 
-        {
-          /* It's a normal block.  We handle it here. */
+  if (d != NULL) 
+    {
+      /* It's a normal block.  We handle it here. */
 
 #ifndef NDEBUG
-          /* Clear the block to help detect use-after-free bugs. */
-          memset (b, 0xcc, d->block_size);
+      /* Clear the block to help detect use-after-free bugs. */
+      memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
+      lock_acquire (&d->lock);
+      d->live_cnt--;
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+      /* If the arena is now entirely unused, keep it in
+         reserve or, if we already have enough, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          if (d->empty_cnt < EMPTY_ARENA_MAX)
+            {
+              d->empty_cnt++;
+              d->arena_keep_cnt++;
+            }
+          else
             {
               size_t i;
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
               for (i = 0; i < d->blocks_per_arena; i++) 
                 {
                   struct block *b = arena_to_block (a, i);
                   list_remove (&b->free_elem);
                 }
               palloc_free_page (a);
+              d->arena_free_cnt++;
             }
-
-          lock_release (&d->lock);
         }
+
+      lock_release (&d->lock);
+    }
+  else
+    {
+      /* It's a big block.  Free its pages. */
+      enum intr_level old_level = intr_disable ();
+      big_live_cnt--;
+      intr_set_level (old_level);
+
+      palloc_free_multiple (a, a->free_cnt);
+    }
+}
+
+/* Prints malloc() statistics: for each size class in use, the
+   blocks currently allocated, the share of allocated bytes lost
+   to rounding requests up to the block size, and how often
+   arenas were obtained from and returned to the page allocator.
+   With malloc_accounting, also prints the call sites that hold
+   memory, most live bytes first.  utils/backtrace turns their
+   addresses into function names. */
+void
+malloc_print_stats (void) 
+{
+  static struct site *sorted[SITE_CNT + 1];
+  size_t sorted_cnt = 0;
+  struct desc *d;
+  size_t i;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->alloc_cnt > 0)
+      printf ("Malloc: %zu-byte blocks: %zu live, %lld allocs, "
+              "%lld%% internal fragmentation, %lld arenas allocated, "
+              "%lld freed, %lld kept\n",
+              d->block_size, d->live_cnt, d->alloc_cnt,
+              100 - d->req_bytes * 100 / (d->alloc_cnt * d->block_size),
+              d->arena_get_cnt, d->arena_free_cnt, d->arena_keep_cnt);
+  if (big_alloc_cnt > 0)
+    printf ("Malloc: big blocks: %zu live, %lld allocs, %lld%% internal "
+            "fragmentation\n",
+            big_live_cnt, big_alloc_cnt,
+            100 - big_req_bytes * 100 / big_bytes);
+  if (realloc_inplace_cnt + realloc_move_cnt > 0)
+    printf ("Malloc: realloc: %lld in place, %lld moved\n",
+            realloc_inplace_cnt, realloc_move_cnt);
+
+  if (!malloc_accounting)
+    return;
+  for (i = 0; i < SITE_CNT; i++)
+    if (sites[i].alloc_cnt > 0)
+      sorted[sorted_cnt++] = &sites[i];
+  if (overflow_site.alloc_cnt > 0)
+    sorted[sorted_cnt++] = &overflow_site;
+  qsort (sorted, sorted_cnt, sizeof *sorted, compare_sites);
+  for (i = 0; i < sorted_cnt; i++) 
+    {
+      struct site *s = sorted[i];
+      if (s == &overflow_site)
+        printf ("Malloc: other sites:");
       else
+        printf ("Malloc: site %p:", s->pc);
+      printf (" %zu live bytes in %zu blocks, peak %zu bytes, "
+              "%lld allocs\n",
+              s->live_bytes, s->live_cnt, s->peak_bytes, s->alloc_cnt);
+    }
+}
+
+/* Compares two call sites, given as pointers to struct site
+   pointers, for sorting by decreasing live bytes and then by
+   decreasing peak bytes. */
+static int
+compare_sites (const void *a_, const void *b_) 
+{
+  const struct site *a = *(struct site *const *) a_;
+  const struct site *b = *(struct site *const *) b_;
+
+  if (a->live_bytes != b->live_bytes)
+    return a->live_bytes < b->live_bytes ? 1 : -1;
+  if (a->peak_bytes != b->peak_bytes)
+    return a->peak_bytes < b->peak_bytes ? 1 : -1;
+  return 0;
+}
+
+/* Charges a new block of SIZE bytes to the call site at PC and
+   returns the site. */
+static struct site *
+site_charge (void *pc, size_t size) 
+{
+  size_t idx = ((uintptr_t) pc >> 2) & (SITE_CNT - 1);
+  struct site *s = &overflow_site;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < SITE_CNT; i++)
+    {
+      struct site *t = &sites[(idx + i) & (SITE_CNT - 1)];
+      if (t->pc == pc || t->pc == NULL)
         {
-          /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
-          return;
+          t->pc = pc;
+          s = t;
+          break;
         }
     }
+  s->live_cnt++;
+  s->alloc_cnt++;
+  intr_set_level (old_level);
+
+  site_resize (s, 0, size);
+  return s;
+}
+
+/* Records that a block charged to site S changed size from
+   OLD_SIZE to NEW_SIZE bytes.  A NEW_SIZE of 0 means that the
+   block was freed. */
+static void
+site_resize (struct site *s, size_t old_size, size_t new_size) 
+{
+  enum intr_level old_level = intr_disable ();
+  s->live_bytes += new_size - old_size;
+  if (s->live_bytes > s->peak_bytes)
+    s->peak_bytes = s->live_bytes;
+  if (new_size == 0)
+    s->live_cnt--;
+  intr_set_level (old_level);
+}
+
+/* Returns the smallest descriptor that satisfies a SIZE-byte
+   request, or a null pointer if SIZE is too big for any
+   descriptor. */
+static struct desc *
+find_desc (size_t size) 
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      return d;
+  return NULL;
+}
+
+/* Tries to resize BLOCK to NEW_SIZE bytes without moving it.
+   Returns true if successful, false if BLOCK must move. */
+static bool
+resize_in_place (void *block, size_t new_size) 
+{
+  struct arena *a = block_to_arena (block);
+  size_t page_cnt;
+
+  /* A normal block can only stay in its own size class. */
+  if (a->desc != NULL)
+    return find_desc (new_size) == a->desc;
+
+  /* A big block shrinking below a page would waste most of
+     it, so move it into a size class. */
+  if (find_desc (new_size) != NULL)
+    return false;
+
+  page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+  if (page_cnt < a->free_cnt)
+    palloc_free_multiple ((uint8_t *) a + page_cnt * PGSIZE,
+                          a->free_cnt - page_cnt);
+  else if (page_cnt > a->free_cnt
+           && !palloc_extend (a, a->free_cnt, page_cnt))
+    return false;
+  a->free_cnt = page_cnt;
+  return true;
 }
-
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
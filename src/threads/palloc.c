@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -23,7 +24,97 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, pages are handed out by a binary buddy
+   allocator.  The pool is viewed as one block of 2**TOP_ORDER
+   pages, recursively split in halves, and a complete binary
+   tree with one byte per block records the order of the largest
+   free aligned block inside it (plus one, so that 0 means "no
+   free pages here").  Two free buddies coalesce automatically,
+   because a block whose halves are both entirely free counts as
+   entirely free itself.
+
+   A request for PAGE_CNT pages descends from the root to the
+   leftmost block of the smallest order that holds PAGE_CNT
+   pages, then marks only PAGE_CNT pages of it as used, leaving
+   the tail free.  Freeing marks the range free again, in
+   aligned pieces.  Either way each piece costs one walk from the
+   root to a node and back, so both are O(log n) in the pool size
+   instead of a bit-by-bit scan.
+
+   The used_map bitmap is kept alongside the tree for sanity
+   checks.
+
+   Single pages, by far the most common request, normally skip
+   the tree and the lock altogether.  Each pool keeps a small
+   "magazine" of pages that palloc_get_page() pops and
+   palloc_free_page() pushes with interrupts disabled, which is
+   all the exclusion a uniprocessor needs.  An empty magazine is
+   refilled, and a full one drained, MAG_BATCH pages at a time
+   under the pool lock.  Pages sitting in a magazine still count
+   as allocated to the buddy tree, so a multi-page request that
+   fails flushes the magazine back into the tree and retries.
+
+   Each pool also keeps a stock of pages that are already zeroed,
+   filled by the idle thread through palloc_prezero_page() when
+   nothing else is runnable.  Single-page PAL_ZERO requests take
+   from that stock first and so skip the memset().  Under memory
+   pressure the stock is given up like the magazine.
+
+   The split between the pools is not absolute.  When a pool runs
+   dry, it may borrow pages from the other pool, as long as the
+   lender keeps at least its "reserve" of free pages afterward.
+   Which pools may borrow is set by palloc_lend_policy.  Borrowed
+   pages go back to the pool they came from when they are freed,
+   since palloc_free_multiple() finds the pool by address, and
+   each pool's lent_map remembers which of its pages are out on
+   loan.  A caller that has a better way to get memory back than
+   borrowing, such as the frame table, which can evict pages,
+   passes PAL_NOBORROW. */
+
+/* Magazine capacity and refill/drain batch size, in pages. */
+#define MAG_SIZE 32
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Most pre-zeroed pages kept per pool. */
+#define ZEROED_MAX 64
+
+/* Share of each pool, as a divisor of its size, that it keeps
+   free when lending pages to the other pool.  The kernel keeps
+   more, because it cannot evict anything to free memory. */
+#define KERNEL_RESERVE_DIV 4
+#define USER_RESERVE_DIV 8
+
+/* Which pools may borrow pages from the other.  Set by the
+   "-lend" kernel command-line option.
+
+   By default only the user pool borrows.  Kernel pages can't be
+   evicted, so user pool pages lent to the kernel would be lost
+   to the frame table until the kernel happened to free them,
+   without the eviction code or its watermarks, which count only
+   the user pool's free pages, knowing about it. */
+enum palloc_lend_policy palloc_lend_policy = LEND_TO_USER;
+
+/* Stock of free pages that are known to be all zeros. */
+struct zeroed_stock
+  {
+    size_t page_cnt;                    /* Number of pages in PAGES. */
+    size_t target;                      /* Pages the idle thread aims for. */
+    void *pages[ZEROED_MAX];            /* Zeroed pages. */
+    long long hit_cnt;                  /* PAL_ZERO pages served from stock. */
+    long long miss_cnt;                 /* PAL_ZERO pages zeroed on demand. */
+  };
+
+/* Cache of free single pages in front of a pool. */
+struct magazine
+  {
+    size_t page_cnt;                    /* Number of pages in PAGES. */
+    void *pages[MAG_SIZE];              /* Cached pages, newest last. */
+    long long hit_cnt;                  /* Gets served from the magazine. */
+    long long refill_cnt;               /* Batches taken from the pool. */
+    long long drain_cnt;                /* Batches returned to the pool. */
+  };
 
 /* A memory pool. */
 struct pool
@@ -31,14 +122,51 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    uint8_t *tree;                      /* Buddy tree, indexed from 1. */
+    size_t top_order;                   /* Order of the root block. */
+    size_t free_cnt;                    /* Number of free pages. */
+    size_t peak_used;                   /* Most pages ever in use. */
+    struct pool *lender;                /* Pool to borrow from, or null. */
+    size_t reserve;                     /* Free pages kept when lending. */
+    struct bitmap *lent_map;            /* Pages lent to the other pool. */
+    size_t lent_cnt;                    /* Number of pages lent now. */
+    long long borrow_cnt;               /* Pages ever borrowed. */
+    struct list deferred;               /* Frees waiting for the lock. */
+    struct magazine magazine;           /* Single-page cache. */
+    struct zeroed_stock zeroed;         /* Pre-zeroed pages. */
+  };
+
+/* A free run parked on a pool's deferred list, stored in the
+   first of the pages being freed. */
+struct deferred_free
+  {
+    struct list_elem elem;              /* Element in pool's deferred list. */
+    size_t page_cnt;                    /* Number of pages. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
+                       size_t reserve_div, const char *name);
+static void *get_pages (struct pool *, enum palloc_flags, size_t page_cnt);
+static void *borrow_pages (struct pool *, enum palloc_flags, size_t page_cnt);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void set_range (struct pool *, size_t page_idx, size_t page_cnt,
+                       bool free);
+static void note_usage (struct pool *);
+static void drain_deferred (struct pool *);
+static void release_pages (struct pool *, void *pages, size_t page_cnt);
+static void *magazine_get (struct pool *);
+static void magazine_put (struct pool *, void *page);
+static void magazine_flush (struct pool *);
+static void *zeroed_get (struct pool *);
+static void zeroed_flush (struct pool *);
+static size_t take_cached (struct pool *, size_t start, size_t cnt,
+                           bool remove);
+static void print_pool_stats (const struct pool *, const char *name);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -56,47 +184,122 @@ palloc_init (size_t user_page_limit)
   kernel_pages = free_pages - user_pages;
 
   /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
+  init_pool (&kernel_pool, free_start, kernel_pages, KERNEL_RESERVE_DIV,
+             "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+             user_pages, USER_RESERVE_DIV, "user pool");
+
+  /* A user page limit is meant to squeeze user memory, so don't
+     let the user pool escape it by borrowing. */
+  if (palloc_lend_policy & LEND_TO_KERNEL)
+    kernel_pool.lender = &user_pool;
+  if ((palloc_lend_policy & LEND_TO_USER) && user_page_limit == SIZE_MAX)
+    user_pool.lender = &kernel_pool;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   then the pages are filled with zeros.  If PAL_NOBORROW is set,
+   the pages never come from the other pool.  If too few pages
+   are available, returns a null pointer, unless PAL_ASSERT is
+   set in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  pages = get_pages (pool, flags, page_cnt);
+  if (pages == NULL && !(flags & PAL_NOBORROW))
+    pages = borrow_pages (pool, flags, page_cnt);
+  if (pages == NULL && (flags & PAL_ASSERT))
+    PANIC ("palloc_get: out of pages");
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  return pages;
+}
+
+/* Obtains and returns PAGE_CNT contiguous free pages from POOL,
+   zeroed if PAL_ZERO is set in FLAGS, or a null pointer if POOL
+   has too few free pages. */
+static void *
+get_pages (struct pool *pool, enum palloc_flags flags, size_t page_cnt) 
+{
+  void *pages;
+  size_t page_idx;
+
+  if (page_cnt == 1 && (flags & PAL_ZERO)) 
+    {
+      pages = zeroed_get (pool);
+      if (pages != NULL)
+        {
+          pool->zeroed.hit_cnt++;
+          return pages;
+        }
+      pool->zeroed.miss_cnt++;
+    }
 
-  if (pages != NULL) 
+  if (page_cnt == 1)
     {
-      if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
+      pages = magazine_get (pool);
+      if (pages == NULL)
+        pages = zeroed_get (pool);
     }
-  else 
+  else
     {
-      if (flags & PAL_ASSERT)
-        PANIC ("palloc_get: out of pages");
+      lock_acquire (&pool->lock);
+      drain_deferred (pool);
+      page_idx = buddy_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR)
+        {
+          magazine_flush (pool);
+          zeroed_flush (pool);
+          page_idx = buddy_alloc (pool, page_cnt);
+        }
+      lock_release (&pool->lock);
+
+      if (page_idx != BITMAP_ERROR)
+        pages = pool->base + PGSIZE * page_idx;
+      else
+        pages = NULL;
     }
 
+  if (pages != NULL && (flags & PAL_ZERO))
+    memset (pages, 0, PGSIZE * page_cnt);
+
+  return pages;
+}
+
+/* Obtains PAGE_CNT contiguous pages for POOL, which has run out,
+   from the pool it may borrow from, if that pool can spare them
+   without dipping into its reserve.  Returns the pages, zeroed
+   if PAL_ZERO is set in FLAGS, or a null pointer on failure. */
+static void *
+borrow_pages (struct pool *pool, enum palloc_flags flags, size_t page_cnt) 
+{
+  struct pool *lender = pool->lender;
+  enum intr_level old_level;
+  void *pages;
+
+  /* The free count is read without the lock, which is fine for
+     a policy decision. */
+  if (lender == NULL || lender->free_cnt < lender->reserve + page_cnt)
+    return NULL;
+
+  pages = get_pages (lender, flags, page_cnt);
+  if (pages == NULL)
+    return NULL;
+
+  old_level = intr_disable ();
+  bitmap_set_multiple (lender->lent_map, pg_no (pages) - pg_no (lender->base),
+                       page_cnt, true);
+  lender->lent_cnt += page_cnt;
+  pool->borrow_cnt += page_cnt;
+  intr_set_level (old_level);
+
   return pages;
 }
 
@@ -113,7 +316,12 @@ palloc_get_page (enum palloc_flags flags)
   return palloc_get_multiple (flags, 1);
 }
 
-/* Frees the PAGE_CNT pages starting at PAGES. */
+/* Frees the PAGE_CNT pages starting at PAGES.
+
+   With interrupts off we may be inside the scheduler, which must
+   not sleep on the pool lock, so in that case the pages are
+   parked on the pool's deferred list and returned by the next
+   thread that takes the lock. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
@@ -138,7 +346,35 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 #endif
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+#ifndef NDEBUG
+  {
+    /* Free pages in the magazine and the pre-zeroed stock are
+       still marked used in USED_MAP, so check them too, to catch
+       a page being freed twice. */
+    enum intr_level old_level = intr_disable ();
+    ASSERT (take_cached (pool, page_idx, page_cnt, false) == 0);
+    intr_set_level (old_level);
+  }
+#endif
+
+  /* Pages on loan come home. */
+  if (pool->lent_cnt > 0)
+    {
+      enum intr_level old_level = intr_disable ();
+      size_t lent_cnt = bitmap_count (pool->lent_map, page_idx, page_cnt,
+                                      true);
+      if (lent_cnt > 0)
+        {
+          bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, false);
+          pool->lent_cnt -= lent_cnt;
+        }
+      intr_set_level (old_level);
+    }
+
+  if (page_cnt == 1)
+    magazine_put (pool, pages);
+  else
+    release_pages (pool, pages, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +384,208 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Tries to grow the block of PAGE_CNT pages at PAGES, obtained
+   from palloc_get_multiple(), to NEW_CNT pages in place.  This
+   succeeds only if the pages that follow the block are free.
+   Returns true if successful, false otherwise.  The new pages
+   are not zeroed.
+
+   To shrink a block, free its tail with palloc_free_multiple(). */
+bool
+palloc_extend (void *pages, size_t page_cnt, size_t new_cnt)
+{
+  struct pool *pool;
+  size_t start, cnt, used_cnt;
+  enum intr_level old_level;
+  bool success = false;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (new_cnt >= page_cnt);
+
+  if (page_from_pool (&kernel_pool, pages))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, pages))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+
+  start = pg_no (pages) - pg_no (pool->base) + page_cnt;
+  cnt = new_cnt - page_cnt;
+  if (cnt == 0)
+    return true;
+  if (start + cnt > bitmap_size (pool->used_map))
+    return false;
+
+  lock_acquire (&pool->lock);
+  drain_deferred (pool);
+
+  /* Pages that sit in the magazine or the pre-zeroed stock are
+     free in all but name, so take them out of there.  If any
+     other page in the range is in use, give up. */
+  used_cnt = bitmap_count (pool->used_map, start, cnt, true);
+  old_level = intr_disable ();
+  if (used_cnt == 0
+      || take_cached (pool, start, cnt, false) == used_cnt)
+    {
+      take_cached (pool, start, cnt, true);
+      success = true;
+
+      /* A block on loan stays on loan as it grows. */
+      if (bitmap_test (pool->lent_map, start - 1))
+        {
+          bitmap_set_multiple (pool->lent_map, start, cnt, true);
+          pool->lent_cnt += cnt;
+        }
+    }
+  intr_set_level (old_level);
+
+  if (success)
+    {
+      bitmap_set_multiple (pool->used_map, start, cnt, true);
+      set_range (pool, start, cnt, false);
+      pool->free_cnt -= cnt - used_cnt;
+      note_usage (pool);
+    }
+  lock_release (&pool->lock);
+
+  return success;
+}
+
+/* Zeroes one free page for the pre-zeroed stock of a pool that
+   is below its target.  Returns false if there was nothing to
+   do, or if doing it would have meant waiting for a lock.
+
+   Meant to be called by the idle thread, which must never
+   block, so pages come from the magazine or, failing that, from
+   the buddy tree only if its lock is free right now.  The
+   zeroing itself runs with interrupts on. */
+bool
+palloc_prezero_page (void) 
+{
+  struct pool *pools[] = {&kernel_pool, &user_pool};
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++) 
+    {
+      struct pool *pool = pools[i];
+      struct zeroed_stock *z = &pool->zeroed;
+      struct magazine *m = &pool->magazine;
+      void *page = NULL;
+      enum intr_level old_level;
+
+      if (z->page_cnt >= z->target)
+        continue;
+
+      old_level = intr_disable ();
+      if (m->page_cnt > 0)
+        page = m->pages[--m->page_cnt];
+
+      /* The idle thread runs only when no other thread can, so
+         it must not be preempted while holding the pool lock. */
+      if (page == NULL && lock_try_acquire (&pool->lock)) 
+        {
+          size_t page_idx;
+
+          drain_deferred (pool);
+          page_idx = buddy_alloc (pool, 1);
+          if (page_idx != BITMAP_ERROR)
+            page = pool->base + PGSIZE * page_idx;
+          lock_release (&pool->lock);
+        }
+      intr_set_level (old_level);
+      if (page == NULL)
+        continue;
+
+      memset (page, 0, PGSIZE);
+
+      old_level = intr_disable ();
+      if (z->page_cnt < ZEROED_MAX)
+        {
+          z->pages[z->page_cnt++] = page;
+          page = NULL;
+        }
+      intr_set_level (old_level);
+      if (page != NULL)
+        magazine_put (pool, page);
+      return true;
+    }
+  return false;
+}
+
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool, counting those
+   held in its magazine and pre-zeroed stock.  The count is read
+   without locking, so it is only good as a hint. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) 
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  return pool->free_cnt + pool->magazine.page_cnt + pool->zeroed.page_cnt;
+}
+
+/* Prints page allocator statistics.  For each pool this
+   includes the largest free block as a share of all free pages,
+   a measure of fragmentation: at 100% every free page could be
+   handed out in a single request. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool, "kernel");
+  print_pool_stats (&user_pool, "user");
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static size_t
+order_for (size_t page_cnt) 
+{
+  size_t order = 0;
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, void *base, size_t page_cnt, size_t reserve_div,
+           const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map, lent_map and buddy tree at its
+     base.  Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t top_order = order_for (page_cnt);
+  size_t tree_size = (size_t) 2 << top_order;
+  size_t bm_pages = DIV_ROUND_UP (2 * bm_size + tree_size, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
+  /* Initialize the pool.  The tree starts out with nothing free,
+     then every page is freed into it. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
   p->base = base + bm_pages * PGSIZE;
+  p->lent_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + bm_size,
+                                      bm_size);
+  p->tree = (uint8_t *) base + 2 * bm_size;
+  p->top_order = top_order;
+  p->tree[1] = 0;
+  p->free_cnt = 0;
+  p->peak_used = 0;
+  p->lender = NULL;
+  p->reserve = page_cnt / reserve_div;
+  p->lent_cnt = 0;
+  p->borrow_cnt = 0;
+  list_init (&p->deferred);
+  memset (&p->magazine, 0, sizeof p->magazine);
+  memset (&p->zeroed, 0, sizeof p->zeroed);
+  p->zeroed.target = page_cnt / 32 < ZEROED_MAX ? page_cnt / 32 : ZEROED_MAX;
+  bitmap_set_all (p->used_map, true);
+  bitmap_set_all (p->lent_map, false);
+  buddy_free (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -180,3 +599,365 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Buddy tree node values.  Node N covers a block of 2**ORDER
+   pages, and its children are nodes 2N and 2N + 1.  A node whose
+   block is entirely free has value ORDER + 1; one with no free
+   pages has value 0.  The children of such a node may be stale,
+   so push_down() rewrites them before the walk descends. */
+
+/* Makes the children of NODE, which covers a block of 2**ORDER
+   pages, agree with NODE if NODE is entirely free or entirely
+   used. */
+static void
+push_down (struct pool *pool, size_t node, size_t order) 
+{
+  uint8_t value = pool->tree[node];
+  if (value == 0 || value == order + 1)
+    pool->tree[2 * node] = pool->tree[2 * node + 1] = value == 0 ? 0 : order;
+}
+
+/* Marks the aligned block of 2**ORDER pages at PAGE_IDX in POOL
+   entirely free if FREE is true, entirely used otherwise, and
+   updates its ancestors, merging buddies that are now both
+   free. */
+static void
+set_block (struct pool *pool, size_t page_idx, size_t order, bool free) 
+{
+  size_t node = 1;
+  size_t node_order = pool->top_order;
+
+  ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+  while (node_order > order) 
+    {
+      push_down (pool, node, node_order);
+      node_order--;
+      node = 2 * node + ((page_idx >> node_order) & 1);
+    }
+  pool->tree[node] = free ? order + 1 : 0;
+
+  while (node > 1) 
+    {
+      uint8_t left, right;
+
+      node /= 2;
+      node_order++;
+      left = pool->tree[2 * node];
+      right = pool->tree[2 * node + 1];
+      if (left == node_order && right == node_order)
+        pool->tree[node] = node_order + 1;
+      else
+        pool->tree[node] = left > right ? left : right;
+    }
+}
+
+/* Marks the PAGE_CNT pages starting at PAGE_IDX in POOL free if
+   FREE is true, used otherwise, as the largest aligned blocks
+   that the range contains. */
+static void
+set_range (struct pool *pool, size_t page_idx, size_t page_cnt, bool free) 
+{
+  while (page_cnt > 0) 
+    {
+      size_t order = 0;
+      while (order < pool->top_order
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      set_block (pool, page_idx, order, free);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first one, or BITMAP_ERROR if no free block is
+   big enough.  POOL's lock must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) 
+{
+  size_t order = order_for (page_cnt);
+  size_t node = 1;
+  size_t node_order = pool->top_order;
+  size_t page_idx;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  if (order > pool->top_order || pool->tree[1] < order + 1)
+    return BITMAP_ERROR;
+
+  /* Descend to the leftmost entirely free block of ORDER. */
+  while (node_order > order) 
+    {
+      push_down (pool, node, node_order);
+      node_order--;
+      node *= 2;
+      if (pool->tree[node] < order + 1)
+        node++;
+    }
+  page_idx = (node - ((size_t) 1 << (pool->top_order - order))) << order;
+
+  ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  set_range (pool, page_idx, page_cnt, false);
+  pool->free_cnt -= page_cnt;
+  note_usage (pool);
+  return page_idx;
+}
+
+/* Updates POOL's high-water mark. */
+static void
+note_usage (struct pool *pool) 
+{
+  size_t used = bitmap_size (pool->used_map) - pool->free_cnt;
+  if (used > pool->peak_used)
+    pool->peak_used = used;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL.
+   POOL's lock must be held, or POOL must not be in use yet. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  set_range (pool, page_idx, page_cnt, true);
+  pool->free_cnt += page_cnt;
+}
+
+/* Frees the runs parked on POOL's deferred list.
+   POOL's lock must be held. */
+static void
+drain_deferred (struct pool *pool) 
+{
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  for (;;) 
+    {
+      struct deferred_free *d = NULL;
+      enum intr_level old_level = intr_disable ();
+      if (!list_empty (&pool->deferred))
+        d = list_entry (list_pop_front (&pool->deferred),
+                        struct deferred_free, elem);
+      intr_set_level (old_level);
+
+      if (d == NULL)
+        break;
+      buddy_free (pool, pg_no (d) - pg_no (pool->base), d->page_cnt);
+    }
+}
+
+/* Returns the PAGE_CNT pages starting at PAGES to POOL's buddy
+   tree.  With interrupts off we may be inside the scheduler,
+   which must not sleep on the pool lock, so in that case the
+   pages are parked on the pool's deferred list and returned by
+   the next thread that takes the lock. */
+static void
+release_pages (struct pool *pool, void *pages, size_t page_cnt) 
+{
+  if (intr_get_level () == INTR_OFF)
+    {
+      struct deferred_free *d = pages;
+      d->page_cnt = page_cnt;
+      list_push_back (&pool->deferred, &d->elem);
+    }
+  else
+    {
+      lock_acquire (&pool->lock);
+      drain_deferred (pool);
+      buddy_free (pool, pg_no (pages) - pg_no (pool->base), page_cnt);
+      lock_release (&pool->lock);
+    }
+}
+
+/* Returns a page from POOL's magazine, refilling the magazine
+   from the buddy tree if it is empty.  Returns a null pointer if
+   POOL has no free pages. */
+static void *
+magazine_get (struct pool *pool) 
+{
+  struct magazine *m = &pool->magazine;
+  void *batch[MAG_BATCH];
+  size_t batch_cnt = 0;
+  void *page = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (m->page_cnt > 0)
+    {
+      page = m->pages[--m->page_cnt];
+      m->hit_cnt++;
+    }
+  intr_set_level (old_level);
+  if (page != NULL)
+    return page;
+
+  /* Refill. */
+  lock_acquire (&pool->lock);
+  drain_deferred (pool);
+  while (batch_cnt < MAG_BATCH) 
+    {
+      size_t page_idx = buddy_alloc (pool, 1);
+      if (page_idx == BITMAP_ERROR)
+        break;
+      batch[batch_cnt++] = pool->base + PGSIZE * page_idx;
+    }
+  lock_release (&pool->lock);
+  if (batch_cnt == 0)
+    return NULL;
+
+  /* Keep one page for the caller.  Another thread may have
+     refilled the magazine meanwhile, so whatever doesn't fit
+     goes straight back. */
+  old_level = intr_disable ();
+  page = batch[--batch_cnt];
+  while (batch_cnt > 0 && m->page_cnt < MAG_SIZE)
+    m->pages[m->page_cnt++] = batch[--batch_cnt];
+  m->refill_cnt++;
+  intr_set_level (old_level);
+  while (batch_cnt > 0)
+    release_pages (pool, batch[--batch_cnt], 1);
+
+  return page;
+}
+
+/* Puts PAGE into POOL's magazine.  If the magazine is full,
+   first returns its MAG_BATCH oldest pages to the buddy tree. */
+static void
+magazine_put (struct pool *pool, void *page) 
+{
+  struct magazine *m = &pool->magazine;
+  void *batch[MAG_BATCH];
+  size_t batch_cnt = 0;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (m->page_cnt >= MAG_SIZE)
+    {
+      batch_cnt = MAG_BATCH;
+      memcpy (batch, m->pages, sizeof batch);
+      m->page_cnt -= MAG_BATCH;
+      memmove (m->pages, m->pages + MAG_BATCH,
+               m->page_cnt * sizeof *m->pages);
+      m->drain_cnt++;
+    }
+  m->pages[m->page_cnt++] = page;
+  intr_set_level (old_level);
+
+  while (batch_cnt > 0)
+    release_pages (pool, batch[--batch_cnt], 1);
+}
+
+/* Returns every page in POOL's magazine to the buddy tree.
+   POOL's lock must be held. */
+static void
+magazine_flush (struct pool *pool) 
+{
+  struct magazine *m = &pool->magazine;
+  void *pages[MAG_SIZE];
+  size_t page_cnt;
+  enum intr_level old_level;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  old_level = intr_disable ();
+  page_cnt = m->page_cnt;
+  memcpy (pages, m->pages, page_cnt * sizeof *pages);
+  m->page_cnt = 0;
+  intr_set_level (old_level);
+
+  while (page_cnt > 0)
+    buddy_free (pool, pg_no (pages[--page_cnt]) - pg_no (pool->base), 1);
+}
+
+/* Takes a page from POOL's pre-zeroed stock, or returns a null
+   pointer if the stock is empty. */
+static void *
+zeroed_get (struct pool *pool) 
+{
+  struct zeroed_stock *z = &pool->zeroed;
+  void *page = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (z->page_cnt > 0)
+    page = z->pages[--z->page_cnt];
+  intr_set_level (old_level);
+
+  return page;
+}
+
+/* Returns every page in POOL's pre-zeroed stock to the buddy
+   tree.  POOL's lock must be held. */
+static void
+zeroed_flush (struct pool *pool) 
+{
+  void *page;
+
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  while ((page = zeroed_get (pool)) != NULL)
+    buddy_free (pool, pg_no (page) - pg_no (pool->base), 1);
+}
+
+/* Removes the entries of ARRAY, which has *CNT elements, that
+   lie among the PAGE_CNT pages starting at index START in POOL,
+   if REMOVE is true.  Returns the number of such entries. */
+static size_t
+take_from_array (struct pool *pool, void **array, size_t *cnt,
+                 size_t start, size_t page_cnt, bool remove) 
+{
+  size_t i, j, taken = 0;
+
+  for (i = j = 0; i < *cnt; i++) 
+    {
+      size_t page_idx = pg_no (array[i]) - pg_no (pool->base);
+      if (page_idx >= start && page_idx < start + page_cnt)
+        taken++;
+      else if (remove)
+        array[j++] = array[i];
+    }
+  if (remove)
+    *cnt = j;
+  return taken;
+}
+
+/* Counts, and if REMOVE is true removes, the pages among the CNT
+   pages starting at index START in POOL that sit in POOL's
+   magazine or pre-zeroed stock.  Returns the count.  Interrupts
+   must be off. */
+static size_t
+take_cached (struct pool *pool, size_t start, size_t cnt, bool remove) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return (take_from_array (pool, pool->magazine.pages,
+                           &pool->magazine.page_cnt, start, cnt, remove)
+          + take_from_array (pool, pool->zeroed.pages,
+                             &pool->zeroed.page_cnt, start, cnt, remove));
+}
+
+/* Prints usage and fragmentation statistics for POOL, named
+   NAME. */
+static void
+print_pool_stats (const struct pool *pool, const char *name) 
+{
+  size_t largest = pool->tree[1] > 0 ? (size_t) 1 << (pool->tree[1] - 1) : 0;
+
+  printf ("Palloc: %s pool: %zu of %zu pages free, peak %zu used, "
+          "largest free block %zu pages (%zu%% of free)\n",
+          name, pool->free_cnt, bitmap_size (pool->used_map),
+          pool->peak_used, largest,
+          pool->free_cnt > 0 ? largest * 100 / pool->free_cnt : 100);
+  printf ("Palloc: %s pool: %zu pages in magazine, %lld hits, "
+          "%lld refills, %lld drains\n",
+          name, pool->magazine.page_cnt, pool->magazine.hit_cnt,
+          pool->magazine.refill_cnt, pool->magazine.drain_cnt);
+  printf ("Palloc: %s pool: %zu pages pre-zeroed, "
+          "%lld PAL_ZERO hits, %lld misses\n",
+          name, pool->zeroed.page_cnt, pool->zeroed.hit_cnt,
+          pool->zeroed.miss_cnt);
+  printf ("Palloc: %s pool: %lld pages borrowed, %zu pages lent out, "
+          "reserve %zu pages\n",
+          name, pool->borrow_cnt, pool->lent_cnt, pool->reserve);
+}
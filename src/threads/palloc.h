@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -8,13 +9,30 @@ enum palloc_flags
   {
     PAL_ASSERT = 001,           /* Panic on failure. */
     PAL_ZERO = 002,             /* Zero page contents. */
-    PAL_USER = 004              /* User page. */
+    PAL_USER = 004,             /* User page. */
+    PAL_NOBORROW = 010          /* Don't borrow from the other pool. */
   };
 
+/* Which pools may borrow pages from the other pool when they
+   run out. */
+enum palloc_lend_policy
+  {
+    LEND_NONE = 0,              /* Neither. */
+    LEND_TO_KERNEL = 1,         /* Kernel pool may borrow from user pool. */
+    LEND_TO_USER = 2,           /* User pool may borrow from kernel pool. */
+    LEND_BOTH = 3               /* Both. */
+  };
+
+extern enum palloc_lend_policy palloc_lend_policy;
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend (void *, size_t page_cnt, size_t new_cnt);
+bool palloc_prezero_page (void);
+size_t palloc_free_cnt (enum palloc_flags);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,291 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   Each slab is a single page obtained from the page allocator.
+   The page begins with a struct slab, followed by a stack of
+   the indexes of the slab's free objects, followed by the
+   objects themselves.  Keeping free-object bookkeeping outside
+   the objects lets constructed state survive a free/alloc
+   cycle, which is the point of having constructors.
+
+   A cache keeps its slabs on three lists.  Allocation prefers a
+   partially used slab, then an empty one, and only then asks
+   the page allocator for a new page.  To avoid bouncing pages
+   back and forth when a single object is repeatedly allocated
+   and freed, up to EMPTY_MAX empty slabs are kept around before
+   further empty slabs are returned to the page allocator. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Empty slabs kept per cache. */
+#define EMPTY_MAX 1
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    uint16_t free_cnt;          /* Number of free objects. */
+    uint16_t free_idx[];        /* Stack of free object indexes. */
+  };
+
+/* All caches, for statistics. */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static struct slab *slab_create (struct kmem_cache *);
+static void slab_destroy (struct kmem_cache *, struct slab *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+static void *slab_obj (struct kmem_cache *, struct slab *, size_t idx);
+
+/* Initializes CACHE to hand out objects of SIZE bytes, naming it
+   NAME for statistics.  CTOR and DTOR may be null. */
+void
+kmem_cache_init (struct kmem_cache *cache, const char *name, size_t size,
+                 void (*ctor) (void *), void (*dtor) (void *))
+{
+  enum intr_level old_level;
+  size_t n;
+
+  ASSERT (cache != NULL);
+  ASSERT (size > 0);
+
+  cache->name = name;
+  cache->obj_size = ROUND_UP (size, sizeof (void *));
+  cache->ctor = ctor;
+  cache->dtor = dtor;
+
+  /* Fit as many objects as possible, each needing its own slot
+     in the free-index stack. */
+  n = (PGSIZE - sizeof (struct slab)) / (cache->obj_size + sizeof (uint16_t));
+  while (n > 0
+         && ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                      sizeof (void *)) + n * cache->obj_size > PGSIZE)
+    n--;
+  ASSERT (n > 0);
+  cache->objs_per_slab = n;
+  cache->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                             sizeof (void *));
+
+  lock_init (&cache->lock);
+  list_init (&cache->partial);
+  list_init (&cache->full);
+  list_init (&cache->empty);
+  cache->slab_cnt = 0;
+  cache->live_cnt = 0;
+  cache->peak_cnt = 0;
+  cache->alloc_cnt = 0;
+  cache->grow_cnt = 0;
+  cache->shrink_cnt = 0;
+  cache->alloc_cycles = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &cache->elem);
+  intr_set_level (old_level);
+}
+
+/* Obtains and returns an object from CACHE, or a null pointer
+   if no memory is available.  If CACHE has a constructor, the
+   object is in its constructed state; otherwise its contents
+   are arbitrary. */
+void *
+kmem_cache_alloc (struct kmem_cache *cache)
+{
+  uint64_t start = rdtsc ();
+  struct slab *slab;
+  void *obj;
+
+  lock_acquire (&cache->lock);
+  if (!list_empty (&cache->partial))
+    slab = list_entry (list_front (&cache->partial), struct slab, elem);
+  else if (!list_empty (&cache->empty))
+    {
+      slab = list_entry (list_pop_front (&cache->empty), struct slab, elem);
+      list_push_front (&cache->partial, &slab->elem);
+    }
+  else
+    {
+      slab = slab_create (cache);
+      if (slab == NULL)
+        {
+          lock_release (&cache->lock);
+          return NULL;
+        }
+      list_push_front (&cache->partial, &slab->elem);
+    }
+
+  obj = slab_obj (cache, slab, slab->free_idx[--slab->free_cnt]);
+  if (slab->free_cnt == 0)
+    {
+      list_remove (&slab->elem);
+      list_push_front (&cache->full, &slab->elem);
+    }
+
+  if (++cache->live_cnt > cache->peak_cnt)
+    cache->peak_cnt = cache->live_cnt;
+  cache->alloc_cnt++;
+  cache->alloc_cycles += rdtsc () - start;
+  lock_release (&cache->lock);
+
+  return obj;
+}
+
+/* Obtains an object from CACHE, which must not have a
+   constructor, and fills it with zeros.  Returns a null pointer
+   if no memory is available. */
+void *
+kmem_cache_zalloc (struct kmem_cache *cache)
+{
+  void *obj;
+
+  ASSERT (cache->ctor == NULL);
+
+  obj = kmem_cache_alloc (cache);
+  if (obj != NULL)
+    memset (obj, 0, cache->obj_size);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from CACHE, to
+   CACHE.  If CACHE has a constructor, OBJ must be back in its
+   constructed state.  If OBJ is a null pointer, does nothing. */
+void
+kmem_cache_free (struct kmem_cache *cache, void *obj)
+{
+  struct slab *slab;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  slab = obj_to_slab (cache, obj);
+  idx = ((uint8_t *) obj - ((uint8_t *) slab + cache->obj_ofs))
+        / cache->obj_size;
+
+  lock_acquire (&cache->lock);
+  ASSERT (slab->free_cnt < cache->objs_per_slab);
+  slab->free_idx[slab->free_cnt++] = idx;
+  cache->live_cnt--;
+
+  if (slab->free_cnt == 1 || slab->free_cnt == cache->objs_per_slab)
+    {
+      list_remove (&slab->elem);
+      if (slab->free_cnt < cache->objs_per_slab)
+        list_push_front (&cache->partial, &slab->elem);
+      else if (list_size (&cache->empty) < EMPTY_MAX)
+        list_push_front (&cache->empty, &slab->elem);
+      else
+        slab_destroy (cache, slab);
+    }
+  lock_release (&cache->lock);
+}
+
+/* Prints statistics for each object cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      printf ("Slab: %s: %zu-byte objects, %zu per slab, "
+              "%zu live (peak %zu) in %zu slabs\n",
+              c->name, c->obj_size, c->objs_per_slab,
+              c->live_cnt, c->peak_cnt, c->slab_cnt);
+      printf ("Slab: %s: %lld allocs, %lld slabs grown, %lld shrunk, "
+              "%llu cycles per alloc\n",
+              c->name, c->alloc_cnt, c->grow_cnt, c->shrink_cnt,
+              c->alloc_cnt > 0 ? c->alloc_cycles / c->alloc_cnt : 0);
+    }
+}
+
+/* Obtains a new slab for CACHE from the page allocator and
+   constructs each of its objects.  Returns a null pointer if no
+   page is available.  CACHE's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *cache)
+{
+  struct slab *slab;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache->lock));
+
+  slab = palloc_get_page (0);
+  if (slab == NULL)
+    return NULL;
+
+  slab->magic = SLAB_MAGIC;
+  slab->cache = cache;
+  slab->free_cnt = cache->objs_per_slab;
+  for (i = 0; i < cache->objs_per_slab; i++)
+    {
+      /* Lowest index on top, so objects are handed out in
+         address order. */
+      slab->free_idx[i] = cache->objs_per_slab - 1 - i;
+      if (cache->ctor != NULL)
+        cache->ctor (slab_obj (cache, slab, i));
+    }
+
+  cache->slab_cnt++;
+  cache->grow_cnt++;
+  return slab;
+}
+
+/* Destroys each object in SLAB, which must have no objects in
+   use and must not be on any list, and returns it to the page
+   allocator.  CACHE's lock must be held. */
+static void
+slab_destroy (struct kmem_cache *cache, struct slab *slab)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache->lock));
+  ASSERT (slab->free_cnt == cache->objs_per_slab);
+
+  if (cache->dtor != NULL)
+    for (i = 0; i < cache->objs_per_slab; i++)
+      cache->dtor (slab_obj (cache, slab, i));
+
+  slab->magic = 0;
+  palloc_free_page (slab);
+  cache->slab_cnt--;
+  cache->shrink_cnt++;
+}
+
+/* Returns the slab that OBJ, an object in CACHE, is in. */
+static struct slab *
+obj_to_slab (struct kmem_cache *cache, void *obj)
+{
+  struct slab *slab = pg_round_down (obj);
+
+  /* Check that the slab is valid and that OBJ is properly
+     aligned within it. */
+  ASSERT (slab != NULL);
+  ASSERT (slab->magic == SLAB_MAGIC);
+  ASSERT (slab->cache == cache);
+  ASSERT (pg_ofs (obj) >= cache->obj_ofs);
+  ASSERT ((pg_ofs (obj) - cache->obj_ofs) % cache->obj_size == 0);
+
+  return slab;
+}
+
+/* Returns object IDX within SLAB in CACHE. */
+static void *
+slab_obj (struct kmem_cache *cache, struct slab *slab, size_t idx)
+{
+  ASSERT (idx < cache->objs_per_slab);
+  return (uint8_t *) slab + cache->obj_ofs + idx * cache->obj_size;
+}
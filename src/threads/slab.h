@@ -0,0 +1,53 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* An object cache.
+
+   Hands out objects of a single, exact size carved from
+   page-sized "slabs", so that a 560-byte object costs 560 bytes
+   plus a small per-slab overhead instead of being rounded up to
+   the next malloc() size class.
+
+   If a constructor is given, it runs once on each object when
+   its slab is created, not on every allocation: objects are
+   expected to be returned to the cache in their constructed
+   state.  The destructor, if any, runs when a slab is given back
+   to the page allocator. */
+struct kmem_cache
+  {
+    const char *name;           /* For statistics. */
+    size_t obj_size;            /* Object size, rounded for alignment. */
+    size_t objs_per_slab;       /* Objects in each slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    void (*ctor) (void *);      /* Constructor, or null. */
+    void (*dtor) (void *);      /* Destructor, or null. */
+    struct lock lock;           /* Protects the members below. */
+
+    struct list partial;        /* Slabs with free and used objects. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list empty;          /* Slabs with no used objects. */
+    size_t slab_cnt;            /* Slabs on all three lists. */
+    size_t live_cnt;            /* Objects currently allocated. */
+    size_t peak_cnt;            /* Maximum value of live_cnt. */
+
+    long long alloc_cnt;        /* Calls to kmem_cache_alloc(). */
+    long long grow_cnt;         /* Slabs obtained from palloc. */
+    long long shrink_cnt;       /* Slabs returned to palloc. */
+    uint64_t alloc_cycles;      /* Total cycles in kmem_cache_alloc(). */
+
+    struct list_elem elem;      /* Element in list of all caches. */
+  };
+
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      void (*ctor) (void *), void (*dtor) (void *));
+void *kmem_cache_alloc (struct kmem_cache *);
+void *kmem_cache_zalloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
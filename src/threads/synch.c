@@ -242,7 +242,12 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
+  {
+    /* lock_release() expects the lock on the holding list. */
+    if (!thread_mlfqs)
+      list_push_back (&thread_current ()->holding_lock_list, &lock->lock_elem);
     lock->holder = thread_current ();
+  }
   return success;
 }
 
@@ -441,6 +441,17 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is runnable, so use the time to zero free
+         pages ahead of PAL_ZERO requests, one page at a time,
+         until some thread becomes ready or there is nothing
+         left to zero. */
+      intr_enable ();
+      while (list_empty (&ready_list) && palloc_prezero_page ())
+        continue;
+      intr_disable ();
+      if (!list_empty (&ready_list))
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -511,6 +522,15 @@ init_thread (struct thread *t, const char *name, int priority)
   t->waiting_lock = NULL;
   list_init (&t->holding_lock_list);
 
+#ifdef USERPROG
+  list_init (&t->children);
+  list_init (&t->files);
+  t->next_handle = 2;
+#endif
+#ifdef VM
+  list_init (&t->mappings);
+#endif
+
   if(thread_mlfqs) 
   {
     t->nice = 0;
@@ -705,7 +725,14 @@ new_priority_check_yield ()
   const int new_priority = thread_current() -> priority;
   const int priority_max = list_entry(list_front(&ready_list), struct thread, elem) -> priority;
   if(new_priority < priority_max)
-    thread_yield();
+  {
+    /* An interrupt handler can't yield directly, e.g. when a
+       disk interrupt wakes a thread while the idle thread runs. */
+    if (intr_context ())
+      intr_yield_on_return ();
+    else
+      thread_yield();
+  }
 }
 
 /* pintos project1 - Priority Inversion */
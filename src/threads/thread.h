@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 
@@ -105,6 +106,23 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct file *exec_file;             /* Executable, open while running. */
+    int exit_status;                    /* Status reported on exit. */
+    struct child *child;                /* Exit status shared w/parent. */
+    struct list children;               /* Children not yet waited for. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list files;                  /* Open files. */
+    int next_handle;                    /* Next file or mapping handle. */
+#endif
+#ifdef VM
+    struct list mappings;               /* Memory mappings. */
+    void *user_esp;                     /* User %esp on entry to kernel. */
+
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    void *ra_next;                      /* Next fault if sequential. */
+    size_t ra_window;                   /* Pages to read ahead then. */
 #endif
 
     /* Owned by thread.c. */
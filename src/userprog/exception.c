@@ -2,8 +2,13 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -20,9 +25,10 @@ static void page_fault (struct intr_frame *);
    signals.  Instead, we'll make them simply kill the user
    process.
 
-   Page faults are an exception.  Here they are treated the same
-   way as other exceptions, but this will need to change to
-   implement virtual memory.
+   Page faults are an exception.  With virtual memory, a page
+   fault on a page that belongs to the process brings the page
+   in; other page faults are treated the same way as other
+   exceptions.
 
    Refer to [IA32-v3a] section 5.15 "Exception and Interrupt
    Reference" for a description of each of these exceptions. */
@@ -148,9 +154,34 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* A fault in the kernel happens during a system call, which
+     saved the user stack pointer for stack growth already. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+
+  /* Bring in the page, if it belongs to the process's address
+     space, or give the process its own copy of a page shared
+     copy-on-write that it writes to.  This also serves the
+     kernel when it touches user memory on a process's behalf. */
+  if ((not_present || write) && is_user_vaddr (fault_addr)
+      && page_in (fault_addr, write))
+    return;
+#endif
+
+  /* A fault in the kernel on a bad user address in get_user()
+     or put_user() in userprog/syscall.c expects -1 in %eax and
+     execution to resume at the address it left there.  Any other
+     kernel fault is a bug. */
+  if (!user && is_user_vaddr (fault_addr)
+      && (uintptr_t) f->eip >= (uintptr_t) user_access_start
+      && (uintptr_t) f->eip < (uintptr_t) user_access_end)
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
@@ -1,24 +1,75 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
+static void update_pte (uint32_t *pd, const void *vaddr, uint32_t *pte,
+                        uint32_t value);
+static void free_page_table (uint32_t *pd, const void *vaddr);
+
+/* Address space switch statistics. */
+static long long switch_cnt;    /* Calls to pagedir_switch(). */
+static long long borrow_cnt;    /* ...by kernel threads, kept CR3. */
+static long long reuse_cnt;     /* ...with PD already active. */
+static long long cr3_load_cnt;  /* CR3 loads, for any reason. */
+
+/* Page table statistics. */
+static long long pt_alloc_cnt;  /* Page tables allocated. */
+static long long pt_reclaim_cnt; /* ...freed before process exit. */
+
+/* A page directory occupies two pages.  The first is the page
+   directory proper.  The second counts, for each user page
+   table, its "live" PTEs, that is, those that are nonzero.
+   Unmapping a page zeroes its PTE, so a page table that maps
+   nothing has no live PTEs.  pagedir_clear_range() frees such a
+   page table right away, and eviction calls pagedir_compact()
+   on each page that it unmaps, which frees the page's table if
+   that was its last mapping.
+
+   Eviction may thus free a page table of a process while that
+   process, or another one evicting its pages, is in the middle
+   of looking at it.  So the functions here hold interrupts off
+   from looking up a PTE until they are done with it, and
+   pagedir_compact() frees page tables with interrupts off. */
+#define PD_PAGES 2
+
+/* Returns the array of live PTE counts for PD, indexed by page
+   directory index. */
+static inline uint16_t *
+live_counts (uint32_t *pd) 
+{
+  return (uint16_t *) (pd + PGSIZE / sizeof *pd);
+}
+
+/* A bulk unmap of more than this many pages flushes the whole
+   TLB instead of invalidating the pages one by one. */
+#define INVLPG_MAX 32
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
-   allocation fails. */
+   allocation fails.
+
+   The kernel mappings are shared with init_page_dir by copying
+   its page directory entries, whether they point to page tables
+   or map 4 MB pages directly. */
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_multiple (0, PD_PAGES);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    {
+      memcpy (pd, init_page_dir, PGSIZE);
+      memset (live_counts (pd), 0, pd_no (PHYS_BASE) * sizeof (uint16_t));
+    }
   return pd;
 }
 
@@ -33,6 +84,7 @@ pagedir_destroy (uint32_t *pd)
     return;
 
   ASSERT (pd != init_page_dir);
+  ASSERT (pd != active_pd ());
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
     if (*pde & PTE_P) 
       {
@@ -44,47 +96,120 @@ pagedir_destroy (uint32_t *pd)
             palloc_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
       }
-  palloc_free_page (pd);
+  palloc_free_multiple (pd, PD_PAGES);
+}
+
+/* Returns a new page directory that maps a private copy of each
+   user page that PD maps, with the same permissions, or a null
+   pointer if memory allocation fails. */
+uint32_t *
+pagedir_dup (uint32_t *pd) 
+{
+  uint32_t *copy;
+  uint32_t *pde;
+
+  ASSERT (pd != init_page_dir);
+
+  copy = pagedir_create ();
+  if (copy == NULL)
+    return NULL;
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P) 
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & PTE_P) 
+            {
+              void *upage = (void *) (((pde - pd) << PDSHIFT)
+                                      | ((pte - pt) << PTSHIFT));
+              void *kpage = palloc_get_page (PAL_USER);
+
+              if (kpage == NULL)
+                goto fail;
+              memcpy (kpage, pte_get_page (*pte), PGSIZE);
+              if (!pagedir_set_page (copy, upage, kpage,
+                                     (*pte & PTE_W) != 0))
+                {
+                  palloc_free_page (kpage);
+                  goto fail;
+                }
+            }
+      }
+  return copy;
+
+ fail:
+  pagedir_destroy (copy);
+  return NULL;
 }
 
 /* Returns the address of the page table entry for virtual
-   address VADDR in page directory PD.
-   If PD does not have a page table for VADDR, behavior depends
-   on CREATE.  If CREATE is true, then a new page table is
-   created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   address VADDR in page directory PD, or a null pointer if PD
+   does not have a page table for VADDR.  Interrupts must be off,
+   and stay off for as long as the caller uses the PTE. */
 static uint32_t *
-lookup_page (uint32_t *pd, const void *vaddr, bool create)
+lookup_page (uint32_t *pd, const void *vaddr)
 {
   uint32_t *pt, *pde;
 
   ASSERT (pd != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  /* Shouldn't create new kernel virtual mappings. */
-  ASSERT (!create || is_user_vaddr (vaddr));
-
-  /* Check for a page table for VADDR.
-     If one is missing, create one if requested. */
+  /* Check for a page table for VADDR. */
   pde = pd + pd_no (vaddr);
   if (*pde == 0) 
-    {
-      if (create)
-        {
-          pt = palloc_get_page (PAL_ZERO);
-          if (pt == NULL) 
-            return NULL; 
-      
-          *pde = pde_create (pt);
-        }
-      else
-        return NULL;
-    }
+    return NULL;
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
   return &pt[pt_no (vaddr)];
 }
 
+/* Gives PD a page table for user virtual address VADDR, unless
+   it has one already.  Returns true if successful, false if
+   memory allocation fails.  Interrupts must be on, and once they
+   are back on, pagedir_compact() may free the page table again,
+   so the caller must check for it once more. */
+static bool
+add_page_table (uint32_t *pd, const void *vaddr) 
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+  enum intr_level old_level;
+  uint32_t *pt;
+
+  ASSERT (is_user_vaddr (vaddr));
+
+  pt = palloc_get_page (PAL_ZERO);
+  if (pt == NULL)
+    return false;
+
+  old_level = intr_disable ();
+  if (*pde == 0) 
+    {
+      *pde = pde_create (pt);
+      pt_alloc_cnt++;
+      pt = NULL;
+    }
+  intr_set_level (old_level);
+
+  /* Someone else added one in the meantime. */
+  palloc_free_page (pt);
+  return true;
+}
+
+/* Returns a copy of the page table entry for virtual address
+   VADDR in page directory PD, or 0 if there is none. */
+static uint32_t
+get_pte (uint32_t *pd, const void *vaddr) 
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t *pte = lookup_page (pd, vaddr);
+  uint32_t value = pte != NULL ? *pte : 0;
+  intr_set_level (old_level);
+  return value;
+}
+
 /* Adds a mapping in page directory PD from user virtual page
    UPAGE to the physical frame identified by kernel virtual
    address KPAGE.
@@ -98,6 +223,7 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
 bool
 pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
 {
+  enum intr_level old_level;
   uint32_t *pte;
 
   ASSERT (pg_ofs (upage) == 0);
@@ -106,16 +232,18 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
   ASSERT (vtop (kpage) >> PTSHIFT < init_ram_pages);
   ASSERT (pd != init_page_dir);
 
-  pte = lookup_page (pd, upage, true);
-
-  if (pte != NULL) 
+  old_level = intr_disable ();
+  while ((pte = lookup_page (pd, upage)) == NULL)
     {
-      ASSERT ((*pte & PTE_P) == 0);
-      *pte = pte_create_user (kpage, writable);
-      return true;
+      intr_set_level (old_level);
+      if (!add_page_table (pd, upage))
+        return false;
+      intr_disable ();
     }
-  else
-    return false;
+  ASSERT ((*pte & PTE_P) == 0);
+  update_pte (pd, upage, pte, pte_create_user (kpage, writable));
+  intr_set_level (old_level);
+  return true;
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -125,35 +253,122 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
 void *
 pagedir_get_page (uint32_t *pd, const void *uaddr) 
 {
+  enum intr_level old_level;
   uint32_t *pte;
+  void *kaddr = NULL;
 
   ASSERT (is_user_vaddr (uaddr));
   
-  pte = lookup_page (pd, uaddr, false);
+  old_level = intr_disable ();
+  pte = lookup_page (pd, uaddr);
   if (pte != NULL && (*pte & PTE_P) != 0)
-    return pte_get_page (*pte) + pg_ofs (uaddr);
-  else
-    return NULL;
+    kaddr = pte_get_page (*pte) + pg_ofs (uaddr);
+  intr_set_level (old_level);
+  return kaddr;
 }
 
-/* Marks user virtual page UPAGE "not present" in page
-   directory PD.  Later accesses to the page will fault.  Other
-   bits in the page table entry are preserved.
+/* Removes the mapping for user virtual page UPAGE from page
+   directory PD.  Later accesses to the page will fault.  The
+   page table entry is zeroed, so the caller must read the page's
+   dirty and accessed bits first if it needs them.  A page table
+   left with no mappings stays, unless pagedir_compact() frees
+   it.
    UPAGE need not be mapped. */
 void
 pagedir_clear_page (uint32_t *pd, void *upage) 
 {
+  enum intr_level old_level;
   uint32_t *pte;
 
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (is_user_vaddr (upage));
 
-  pte = lookup_page (pd, upage, false);
+  old_level = intr_disable ();
+  pte = lookup_page (pd, upage);
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
-      *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      update_pte (pd, upage, pte, 0);
+      invalidate_page (pd, upage);
     }
+  intr_set_level (old_level);
+}
+
+/* Removes the mappings for the PAGE_CNT user virtual pages
+   starting at UPAGE from page directory PD, with a single TLB
+   flush if many of them were mapped.  Like pagedir_clear_page(),
+   this forgets the pages' dirty and accessed bits.  Page tables
+   left with no mappings are freed right away.  The pages need
+   not be mapped. */
+void
+pagedir_clear_range (uint32_t *pd, void *upage, size_t page_cnt) 
+{
+  uint8_t *start = upage;
+  uint8_t *end = start + page_cnt * PGSIZE;
+  uint8_t *page;
+  size_t cleared_cnt = 0;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (page_cnt == 0 || is_user_vaddr (end - 1));
+
+  for (page = start; page < end; page += PGSIZE)
+    {
+      enum intr_level old_level = intr_disable ();
+      uint32_t *pte = lookup_page (pd, page);
+
+      if (pte == NULL)
+        {
+          /* No page table here, so skip to the next one. */
+          page = (uint8_t *) ((uintptr_t) page | (PTSPAN - 1)) + 1 - PGSIZE;
+        }
+      else if (*pte != 0)
+        {
+          bool present = (*pte & PTE_P) != 0;
+
+          /* Zero the PTE before invalidating, so that the CPU
+             can't load the old one back into the TLB. */
+          update_pte (pd, page, pte, 0);
+          if (present && ++cleared_cnt <= INVLPG_MAX)
+            invalidate_page (pd, page);
+          if (live_counts (pd)[pd_no (page)] == 0)
+            free_page_table (pd, page);
+        }
+      intr_set_level (old_level);
+    }
+
+  if (cleared_cnt > INVLPG_MAX)
+    invalidate_pagedir (pd);
+}
+
+/* Makes the mapping for user virtual page UPAGE in PD writable
+   if WRITABLE is true, read-only otherwise.  Unlike
+   pagedir_set_page(), this keeps the PTE's dirty and accessed
+   bits.  UPAGE must be mapped. */
+void
+pagedir_set_writable (uint32_t *pd, const void *upage, bool writable) 
+{
+  enum intr_level old_level;
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  old_level = intr_disable ();
+  pte = lookup_page (pd, upage);
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  if (writable)
+    update_pte (pd, upage, pte, *pte | PTE_W);
+  else
+    update_pte (pd, upage, pte, *pte & ~(uint32_t) PTE_W);
+  invalidate_page (pd, upage);
+  intr_set_level (old_level);
+}
+
+/* Returns true if PD maps virtual page VPAGE writable. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  return (get_pte (pd, vpage) & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
@@ -163,26 +378,27 @@ pagedir_clear_page (uint32_t *pd, void *upage)
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_D) != 0;
+  return (get_pte (pd, vpage) & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
-   in PD. */
+   in PD.  Does nothing if VPAGE is not mapped. */
 void
 pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  if (pte != NULL) 
+  enum intr_level old_level = intr_disable ();
+  uint32_t *pte = lookup_page (pd, vpage);
+  if (pte != NULL && (*pte & PTE_P) != 0) 
     {
       if (dirty)
-        *pte |= PTE_D;
+        update_pte (pd, vpage, pte, *pte | PTE_D);
       else 
         {
-          *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          update_pte (pd, vpage, pte, *pte & ~(uint32_t) PTE_D);
+          invalidate_page (pd, vpage);
         }
     }
+  intr_set_level (old_level);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD has been
@@ -192,26 +408,27 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_A) != 0;
+  return (get_pte (pd, vpage) & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  Does nothing if VPAGE is not mapped. */
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  if (pte != NULL) 
+  enum intr_level old_level = intr_disable ();
+  uint32_t *pte = lookup_page (pd, vpage);
+  if (pte != NULL && (*pte & PTE_P) != 0) 
     {
       if (accessed)
-        *pte |= PTE_A;
+        update_pte (pd, vpage, pte, *pte | PTE_A);
       else 
         {
-          *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          update_pte (pd, vpage, pte, *pte & ~(uint32_t) PTE_A);
+          invalidate_page (pd, vpage);
         }
     }
+  intr_set_level (old_level);
 }
 
 /* Loads page directory PD into the CPU's page directory base
@@ -228,6 +445,103 @@ pagedir_activate (uint32_t *pd)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
      Address of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+  cr3_load_cnt++;
+}
+
+/* Switches to page directory PD on a context switch, lazily.
+
+   A null PD means a kernel thread, which never touches user
+   memory.  Every page directory maps the kernel identically, so
+   a kernel thread simply keeps whichever page directory is
+   loaded.  Otherwise CR3 is reloaded, flushing the TLB, only if
+   PD is not the active page directory already.  Switching
+   between a process and kernel threads such as the idle thread
+   thus costs no TLB flushes at all. */
+void
+pagedir_switch (uint32_t *pd) 
+{
+  switch_cnt++;
+  if (pd == NULL)
+    borrow_cnt++;
+  else if (pd == active_pd ())
+    reuse_cnt++;
+  else
+    pagedir_activate (pd);
+}
+
+/* Frees the page table in PD that covers user virtual page
+   UPAGE, if it no longer maps any page.  Returns true if a page
+   table was freed, false otherwise.
+
+   This may be called from any thread, for any process, as long
+   as PD can't be destroyed in the meantime, for example because
+   the caller holds the lock of one of the process's pages. */
+bool
+pagedir_compact (uint32_t *pd, const void *upage) 
+{
+  enum intr_level old_level;
+  bool freed = false;
+
+  ASSERT (pd != init_page_dir);
+  ASSERT (is_user_vaddr (upage));
+
+  old_level = intr_disable ();
+  if ((pd[pd_no (upage)] & PTE_P) != 0 && live_counts (pd)[pd_no (upage)] == 0)
+    {
+      free_page_table (pd, upage);
+      freed = true;
+    }
+  intr_set_level (old_level);
+  return freed;
+}
+
+/* Prints address space switch and page table statistics. */
+void
+pagedir_print_stats (void) 
+{
+  printf ("Paging: %lld switches, %lld kept by kernel threads, "
+          "%lld already active, %lld CR3 loads\n",
+          switch_cnt, borrow_cnt, reuse_cnt, cr3_load_cnt);
+  printf ("Paging: %lld page tables allocated, %lld freed early\n",
+          pt_alloc_cnt, pt_reclaim_cnt);
+}
+
+/* Stores VALUE into *PTE, the PTE for user virtual address VADDR
+   in PD, keeping the count of live PTEs in its page table up to
+   date. */
+static void
+update_pte (uint32_t *pd, const void *vaddr, uint32_t *pte, uint32_t value) 
+{
+  uint16_t *live_cnt = &live_counts (pd)[pd_no (vaddr)];
+
+  ASSERT (is_user_vaddr (vaddr));
+
+  if (*pte == 0 && value != 0)
+    ++*live_cnt;
+  else if (*pte != 0 && value == 0)
+    --*live_cnt;
+  *pte = value;
+}
+
+/* Frees the page table that covers user virtual address VADDR
+   in PD, which must not map any present page. */
+static void
+free_page_table (uint32_t *pd, const void *vaddr) 
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+  uint32_t *pt = pde_get_pt (*pde);
+
+  *pde = 0;
+  live_counts (pd)[pd_no (vaddr)] = 0;
+
+  /* The CPU may cache page directory entries, so make sure it
+     forgets this one before the page table is reused.  INVLPG
+     flushes such caches as well as the TLB.  See [IA32-v3a]
+     4.10.4.1 "Operations that Invalidate TLBs and
+     Paging-Structure Caches". */
+  invalidate_page (pd, vaddr);
+  palloc_free_page (pt);
+  pt_reclaim_cnt++;
 }
 
 /* Returns the currently active page directory. */
@@ -261,3 +575,14 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/* Invalidates the TLB entry for virtual page VPAGE if PD is the
+   active page directory.  Changing a single PTE this way keeps
+   every other translation in the TLB.  See [IA32-v2a] "INVLPG--
+   Invalidate TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vpage) 
+{
+  if (active_pd () == pd)
+    asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+}
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -14,55 +15,166 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* A child process's exit status, shared between the child and
+   its parent.  Whichever of the two exits last frees it. */
+struct child
+  {
+    struct list_elem elem;      /* Element in parent's `children'. */
+    tid_t tid;                  /* Child's thread id. */
+    int exit_status;            /* Child's exit status, once dead. */
+    struct semaphore dead;      /* Upped when the child exits. */
+    struct lock lock;           /* Protects REF_CNT. */
+    int ref_cnt;                /* Number of processes still using. */
+  };
+
+/* Passed from a process starting a child to the child's
+   thread. */
+struct start_info
+  {
+    const char *cmd_line;           /* exec(): Command line. */
+    const struct intr_frame *if_;   /* fork(): Parent's registers. */
+    struct thread *parent;          /* Process starting the child. */
+    struct child *child;            /* Child's exit status. */
+    struct semaphore started;       /* Upped when started or failed. */
+    bool success;                   /* Did the child start? */
+  };
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static tid_t start_child (const char *name, thread_func *,
+                          struct start_info *);
+static void release_child (struct child *);
+static bool copy_process (struct thread *parent);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
-/* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+/* Starts a new process running a user program loaded from the
+   file named by the first word of FILE_NAME, passing it the
+   words of FILE_NAME as arguments, and waits for it to be
+   loaded.  Returns the new process's thread id, or TID_ERROR if
+   the thread cannot be created or the program cannot be
+   loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
+  struct start_info info;
+  char thread_name[16];
+
+  /* Name the thread after the program. */
+  strlcpy (thread_name, file_name + strspn (file_name, " "),
+           sizeof thread_name);
+  thread_name[strcspn (thread_name, " ")] = '\0';
+
+  /* FILE_NAME stays valid until the new process is loaded,
+     because we wait for that. */
+  info.cmd_line = file_name;
+  info.if_ = NULL;
+  return start_child (thread_name, start_process, &info);
+}
+
+/* Starts a new process that is a copy of the current one,
+   resuming in user mode with the registers in IF_, except that
+   fork() returns 0 in the new process.  Waits for the copy to be
+   made.  Returns the new process's thread id, or TID_ERROR if it
+   cannot be created. */
+tid_t
+process_fork (const struct intr_frame *if_) 
+{
+  struct start_info info;
+
+  info.cmd_line = NULL;
+  info.if_ = if_;
+  return start_child (thread_current ()->name, start_fork, &info);
+}
+
+/* Creates a thread named NAME that runs FUNCTION with INFO to
+   start a child of the current process, and waits until the
+   child either is ready to run user code or has failed.
+   Returns the child's thread id, or TID_ERROR on failure. */
+static tid_t
+start_child (const char *name, thread_func *function,
+             struct start_info *info) 
+{
+  struct thread *cur = thread_current ();
+  struct child *c;
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  c = malloc (sizeof *c);
+  if (c == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  c->exit_status = -1;
+  sema_init (&c->dead, 0);
+  lock_init (&c->lock);
+  c->ref_cnt = 2;
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  info->parent = cur;
+  info->child = c;
+  sema_init (&info->started, 0);
+  info->success = false;
+
+  c->tid = tid = thread_create (name, PRI_DEFAULT, function, info);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    {
+      free (c);
+      return TID_ERROR;
+    }
+  sema_down (&info->started);
+  if (!info->success)
+    {
+      /* The child is exiting, and nobody will wait for it. */
+      release_child (c);
+      return TID_ERROR;
+    }
+  list_push_back (&cur->children, &c->elem);
   return tid;
 }
 
+/* Drops a reference to C, freeing it if it was the last. */
+static void
+release_child (struct child *c) 
+{
+  bool last;
+
+  lock_acquire (&c->lock);
+  last = --c->ref_cnt == 0;
+  lock_release (&c->lock);
+
+  if (last)
+    free (c);
+}
+
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *info_)
 {
-  char *file_name = file_name_;
+  struct start_info *info = info_;
   struct intr_frame if_;
   bool success;
 
+  thread_current ()->child = info->child;
+  thread_current ()->exit_status = -1;
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (info->cmd_line, &if_.eip, &if_.esp);
+
+  /* Tell the parent how it went.  INFO is gone after this. */
+  info->success = success;
+  sema_up (&info->started);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
   if (!success) 
     thread_exit ();
 
@@ -76,18 +188,111 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* A thread function that makes a user process a copy of its
+   parent and starts it running where the parent called
+   fork(). */
+static void
+start_fork (void *info_)
+{
+  struct start_info *info = info_;
+  struct intr_frame if_ = *info->if_;
+  bool success;
+
+  thread_current ()->child = info->child;
+  thread_current ()->exit_status = -1;
+  success = copy_process (info->parent);
+
+  /* Tell the parent how it went.  INFO is gone after this. */
+  info->success = success;
+  sema_up (&info->started);
+
+  if (!success) 
+    thread_exit ();
+
+  /* fork() returns 0 in the child.  Start it like
+     start_process() does. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current process a copy of PARENT's address space,
+   its own handle on PARENT's executable, and copies of PARENT's
+   open files.  With virtual memory, the address space is shared
+   copy-on-write.  PARENT must stay blocked meanwhile.  Returns
+   true if successful, false on failure. */
+static bool
+copy_process (struct thread *parent) 
+{
+  struct thread *t = thread_current ();
+
+#ifdef VM
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    return false;
+  process_activate ();
+  if (!page_table_init ())
+    {
+      /* process_exit() must not destroy a table that doesn't
+         exist.  As there, T's page directory is forgotten before
+         it is destroyed, because the pageout thread may be
+         looking for it. */
+      uint32_t *pd = t->pagedir;
+
+      t->pagedir = NULL;
+      pagedir_activate (NULL);
+      pagedir_destroy (pd);
+      return false;
+    }
+#else
+  t->pagedir = pagedir_dup (parent->pagedir);
+  if (t->pagedir == NULL)
+    return false;
+  process_activate ();
+#endif
+
+  lock_acquire (&filesys_lock);
+  t->exec_file = file_reopen (parent->exec_file);
+  if (t->exec_file != NULL)
+    file_deny_write (t->exec_file);
+  lock_release (&filesys_lock);
+  if (t->exec_file == NULL)
+    return false;
+
+#ifdef VM
+  if (!page_table_copy (parent))
+    return false;
+#endif
+  return syscall_fork (parent);
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct child *c = list_entry (e, struct child, elem);
+      if (c->tid == child_tid)
+        {
+          int status;
+
+          list_remove (e);
+          sema_down (&c->dead);
+          status = c->exit_status;
+          release_child (c);
+          return status;
+        }
+    }
   return -1;
 }
 
@@ -103,6 +308,15 @@ process_exit (void)
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+      printf ("%s: exit(%d)\n", cur->name, cur->exit_status);
+
+      /* Write back memory-mapped files before their pages go
+         away. */
+      syscall_exit ();
+#ifdef VM
+      page_table_destroy ();
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -114,6 +328,29 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+
+  /* Close the executable only now that no page can be read
+     from it any longer. */
+  if (cur->exec_file != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      file_close (cur->exec_file);
+      lock_release (&filesys_lock);
+      cur->exec_file = NULL;
+    }
+
+  /* Report our exit status to our parent, and let go of the
+     children we never waited for. */
+  if (cur->child != NULL)
+    {
+      cur->child->exit_status = cur->exit_status;
+      sema_up (&cur->child->dead);
+      release_child (cur->child);
+      cur->child = NULL;
+    }
+  while (!list_empty (&cur->children))
+    release_child (list_entry (list_pop_front (&cur->children),
+                               struct child, elem));
 }
 
 /* Sets up the CPU for running user code in the current
@@ -124,12 +361,15 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  A kernel thread keeps
+     whatever page tables are loaded. */
+  pagedir_switch (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
-     interrupts. */
-  tss_update ();
+     interrupts from user mode.  A kernel thread never runs in
+     user mode, so it doesn't need one. */
+  if (t->pagedir != NULL)
+    tss_update ();
 }
 
 /* We load ELF binaries.  The following definitions are taken
@@ -195,39 +435,66 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool setup_stack (const char *cmd_line, void **esp);
+static bool push_arguments (const char *cmd_line, void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
+/* Loads an ELF executable from the file named by the first word
+   of CMD_LINE into the current thread, with the words of
+   CMD_LINE as its arguments.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
 bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+load (const char *cmd_line, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
+  char file_name[NAME_MAX + 2];
   struct Elf32_Ehdr ehdr;
   struct file *file = NULL;
   off_t file_ofs;
   bool success = false;
   int i;
 
+  /* Extract the file name.  One that is too long to fit is too
+     long to exist, and stays that way when truncated. */
+  strlcpy (file_name, cmd_line + strspn (cmd_line, " "), sizeof file_name);
+  file_name[strcspn (file_name, " ")] = '\0';
+
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
-    goto done;
+    goto done_unlocked;
   process_activate ();
+#ifdef VM
+  if (!page_table_init ())
+    {
+      /* process_exit() must not destroy a table that doesn't
+         exist.  As there, T's page directory is forgotten before
+         it is destroyed, because the pageout thread may be
+         looking for it. */
+      uint32_t *pd = t->pagedir;
 
-  /* Open executable file. */
+      t->pagedir = NULL;
+      pagedir_activate (NULL);
+      pagedir_destroy (pd);
+      goto done_unlocked;
+    }
+#endif
+
+  /* Open executable file, and keep it from being modified while
+     it runs. */
+  lock_acquire (&filesys_lock);
   file = filesys_open (file_name);
   if (file == NULL) 
     {
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
+  file_deny_write (file);
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -301,9 +568,11 @@ load (const char *file_name, void (**eip) (void), void **esp)
         }
     }
 
-  /* Set up stack. */
-  if (!setup_stack (esp))
-    goto done;
+  /* Set up stack.  Bringing in the stack page may evict a page
+     of a memory-mapped file, which needs the file system. */
+  lock_release (&filesys_lock);
+  if (!setup_stack (cmd_line, esp))
+    goto done_unlocked;
 
   /* Start address. */
   *eip = (void (*) (void)) ehdr.e_entry;
@@ -311,14 +580,20 @@ load (const char *file_name, void (**eip) (void), void **esp)
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  lock_release (&filesys_lock);
+ done_unlocked:
+  /* We arrive here whether the load is successful or not.  The
+     executable stays open until the process exits, because its
+     pages may be loaded on demand. */
+  t->exec_file = file;
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +652,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and each one is initialized
+   when it is first touched.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -387,6 +666,28 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+      bool ok;
+
+      if (page_read_bytes > 0)
+        ok = page_record_file (upage, file, ofs, page_read_bytes, writable);
+      else
+        ok = page_record_zero (upage, writable);
+      if (!ok)
+        return false;
+
+      /* Advance. */
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -422,13 +723,24 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, and push the arguments in CMD_LINE onto
+   it. */
 static bool
-setup_stack (void **esp) 
+setup_stack (const char *cmd_line, void **esp) 
 {
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+
+  /* The stack is touched before the process runs, so bring it
+     in right away. */
+  if (!page_record_anon (upage, true) || !page_in (upage, true))
+    return false;
+  return push_arguments (cmd_line, esp);
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -437,13 +749,66 @@ setup_stack (void **esp)
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
       if (success)
-        *esp = PHYS_BASE;
+        success = push_arguments (cmd_line, esp);
       else
         palloc_free_page (kpage);
     }
   return success;
+#endif
+}
+
+/* Pushes the words of CMD_LINE onto the newly created stack page
+   at the top of user virtual memory, followed by argv[], argv,
+   argc, and a null return address, as the 80x86 calling
+   convention expects for a call to main().  Stores the new stack
+   pointer into *ESP.  Returns true if successful, false if the
+   arguments don't fit in the page. */
+static bool
+push_arguments (const char *cmd_line, void **esp)
+{
+  size_t length = strlen (cmd_line) + 1;
+  char *args, *token, *save_ptr;
+  char **argv;
+  uint32_t *sp;
+  int argc = 0;
+  int i;
+
+  if (length > PGSIZE)
+    return false;
+
+  /* Copy the command line to the top of the stack and split it
+     into words in place. */
+  args = (char *) PHYS_BASE - length;
+  strlcpy (args, cmd_line, length);
+  for (token = strtok_r (args, " ", &save_ptr); token != NULL;
+       token = strtok_r (NULL, " ", &save_ptr))
+    argc++;
+
+  /* Make sure that argv[] and the rest fit below the words. */
+  argv = (char **) ROUND_DOWN ((uintptr_t) args, sizeof (char *)) - (argc + 1);
+  sp = (uint32_t *) argv - 3;
+  if ((uint8_t *) sp < (uint8_t *) PHYS_BASE - PGSIZE)
+    return false;
+
+  /* strtok_r() left each word followed by a null, but there may
+     be spaces before the first word and after any null. */
+  token = args;
+  for (i = 0; i < argc; i++)
+    {
+      token += strspn (token, " ");
+      argv[i] = token;
+      token += strlen (token) + 1;
+    }
+  argv[argc] = NULL;
+
+  sp[2] = (uint32_t) argv;
+  sp[1] = argc;
+  sp[0] = 0;
+  *esp = sp;
+  return true;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +828,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
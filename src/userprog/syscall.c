@@ -1,20 +1,735 @@
 #include "userprog/syscall.h"
+#include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Serializes access to the file system, which is not safe for
+   concurrent use.  Code that holds this lock must not touch user
+   memory that might not be resident, because bringing it in may
+   need the lock too: buffers are pinned first. */
+struct lock filesys_lock;
+
+/* An open file. */
+struct file_descriptor
+  {
+    struct list_elem elem;      /* Element in thread's `files' list. */
+    struct file *file;          /* File. */
+    int handle;                 /* File handle. */
+  };
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in thread's `mappings' list. */
+    int handle;                 /* Mapping id. */
+    struct file *file;          /* File, reopened for the mapping. */
+    uint8_t *base;              /* Start of memory mapping. */
+    size_t page_cnt;            /* Number of pages mapped. */
+  };
+#endif
 
 static void syscall_handler (struct intr_frame *);
 
+static void sys_halt (void) NO_RETURN;
+static void sys_exit (int status) NO_RETURN;
+static int sys_exec (const char *ufile);
+static int sys_wait (tid_t);
+static int sys_fork (struct intr_frame *);
+static int sys_create (const char *ufile, unsigned initial_size);
+static int sys_remove (const char *ufile);
+static int sys_open (const char *ufile);
+static int sys_filesize (int handle);
+static int sys_read (int handle, void *udst, unsigned size);
+static int sys_write (int handle, const void *usrc, unsigned size);
+static void sys_seek (int handle, unsigned position);
+static int sys_tell (int handle);
+static void sys_close (int handle);
+#ifdef VM
+static int sys_mmap (int handle, void *addr);
+static void sys_munmap (int mapping);
+static void unmap (struct mapping *);
+#endif
+
+static void copy_in (void *, const void *, size_t);
+int get_user (const uint8_t *uaddr);
+int put_user (uint8_t *udst, uint8_t byte);
+static char *copy_in_string (const char *);
+static void pin_page (const void *, bool write);
+static void unpin_page (const void *);
+static struct file_descriptor *lookup_fd (int handle);
+
+/* Number of arguments taken by each system call, indexed by
+   number. */
+static const size_t arg_cnts[] =
+  {
+    [SYS_HALT] = 0, [SYS_EXIT] = 1, [SYS_EXEC] = 1, [SYS_WAIT] = 1,
+    [SYS_CREATE] = 2, [SYS_REMOVE] = 1, [SYS_OPEN] = 1,
+    [SYS_FILESIZE] = 1, [SYS_READ] = 3, [SYS_WRITE] = 3, [SYS_SEEK] = 2,
+    [SYS_TELL] = 1, [SYS_CLOSE] = 1, [SYS_MMAP] = 2, [SYS_MUNMAP] = 1,
+    [SYS_FORK] = 0,
+  };
+
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  lock_init (&filesys_lock);
+}
+
+/* System call handler. */
+static void
+syscall_handler (struct intr_frame *f)
+{
+  unsigned call_nr;
+  int args[3];
+
+#ifdef VM
+  /* Page faults on user memory in the kernel need the user stack
+     pointer to tell whether the stack should grow. */
+  thread_current ()->user_esp = f->esp;
+#endif
+
+  /* Get the system call and its arguments. */
+  copy_in (&call_nr, f->esp, sizeof call_nr);
+  if (call_nr >= sizeof arg_cnts / sizeof *arg_cnts)
+    sys_exit (-1);
+  copy_in (args, (uint32_t *) f->esp + 1, sizeof *args * arg_cnts[call_nr]);
+
+  /* Execute the system call,
+     and set the return value. */
+  switch (call_nr)
+    {
+    case SYS_HALT:
+      sys_halt ();
+    case SYS_EXIT:
+      sys_exit (args[0]);
+    case SYS_EXEC:
+      f->eax = sys_exec ((const char *) args[0]);
+      break;
+    case SYS_WAIT:
+      f->eax = sys_wait (args[0]);
+      break;
+    case SYS_CREATE:
+      f->eax = sys_create ((const char *) args[0], args[1]);
+      break;
+    case SYS_REMOVE:
+      f->eax = sys_remove ((const char *) args[0]);
+      break;
+    case SYS_OPEN:
+      f->eax = sys_open ((const char *) args[0]);
+      break;
+    case SYS_FILESIZE:
+      f->eax = sys_filesize (args[0]);
+      break;
+    case SYS_READ:
+      f->eax = sys_read (args[0], (void *) args[1], args[2]);
+      break;
+    case SYS_WRITE:
+      f->eax = sys_write (args[0], (const void *) args[1], args[2]);
+      break;
+    case SYS_SEEK:
+      sys_seek (args[0], args[1]);
+      break;
+    case SYS_TELL:
+      f->eax = sys_tell (args[0]);
+      break;
+    case SYS_CLOSE:
+      sys_close (args[0]);
+      break;
+#ifdef VM
+    case SYS_MMAP:
+      f->eax = sys_mmap (args[0], (void *) args[1]);
+      break;
+    case SYS_MUNMAP:
+      sys_munmap (args[0]);
+      break;
+#endif
+    case SYS_FORK:
+      f->eax = sys_fork (f);
+      break;
+    default:
+      sys_exit (-1);
+    }
+}
+
+/* Gives the current process, which is being forked from PARENT,
+   its own copy of each of PARENT's open files, with the same
+   handle and file position.  Memory mappings are not inherited.
+   Returns true if successful, false on failure. */
+bool
+syscall_fork (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  cur->next_handle = parent->next_handle;
+  for (e = list_begin (&parent->files); e != list_end (&parent->files);
+       e = list_next (e))
+    {
+      struct file_descriptor *pfd
+        = list_entry (e, struct file_descriptor, elem);
+      struct file_descriptor *fd = malloc (sizeof *fd);
+
+      if (fd == NULL)
+        return false;
+      lock_acquire (&filesys_lock);
+      fd->file = file_reopen (pfd->file);
+      if (fd->file != NULL)
+        file_seek (fd->file, file_tell (pfd->file));
+      lock_release (&filesys_lock);
+      if (fd->file == NULL)
+        {
+          free (fd);
+          return false;
+        }
+      fd->handle = pfd->handle;
+      list_push_back (&cur->files, &fd->elem);
+    }
+  return true;
 }
 
+/* Closes the current process's files and removes its memory
+   mappings, writing back modified pages.  Called when the
+   process exits. */
+void
+syscall_exit (void)
+{
+  struct thread *cur = thread_current ();
+
+#ifdef VM
+  while (!list_empty (&cur->mappings))
+    unmap (list_entry (list_front (&cur->mappings), struct mapping, elem));
+#endif
+
+  while (!list_empty (&cur->files))
+    {
+      struct file_descriptor *fd;
+
+      fd = list_entry (list_pop_front (&cur->files),
+                       struct file_descriptor, elem);
+      lock_acquire (&filesys_lock);
+      file_close (fd->file);
+      lock_release (&filesys_lock);
+      free (fd);
+    }
+}
+
+/* Halt system call. */
+static void
+sys_halt (void)
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+sys_exit (int status)
 {
-  printf ("system call!\n");
+  thread_current ()->exit_status = status;
   thread_exit ();
 }
+
+/* Exec system call. */
+static int
+sys_exec (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  tid_t tid = process_execute (kfile);
+  palloc_free_page (kfile);
+  return tid;
+}
+
+/* Wait system call. */
+static int
+sys_wait (tid_t child)
+{
+  return process_wait (child);
+}
+
+/* Fork system call.  F holds the caller's registers, which the
+   child starts out with. */
+static int
+sys_fork (struct intr_frame *f)
+{
+  return process_fork (f);
+}
+
+/* Create system call. */
+static int
+sys_create (const char *ufile, unsigned initial_size)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok;
+
+  lock_acquire (&filesys_lock);
+  ok = filesys_create (kfile, initial_size);
+  lock_release (&filesys_lock);
+
+  palloc_free_page (kfile);
+  return ok;
+}
+
+/* Remove system call. */
+static int
+sys_remove (const char *ufile)
+{
+  char *kfile = copy_in_string (ufile);
+  bool ok;
+
+  lock_acquire (&filesys_lock);
+  ok = filesys_remove (kfile);
+  lock_release (&filesys_lock);
+
+  palloc_free_page (kfile);
+  return ok;
+}
+
+/* Open system call. */
+static int
+sys_open (const char *ufile)
+{
+  struct thread *cur = thread_current ();
+  char *kfile = copy_in_string (ufile);
+  struct file_descriptor *fd;
+  int handle = -1;
+
+  fd = malloc (sizeof *fd);
+  if (fd != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      fd->file = filesys_open (kfile);
+      lock_release (&filesys_lock);
+      if (fd->file != NULL)
+        {
+          handle = fd->handle = cur->next_handle++;
+          list_push_front (&cur->files, &fd->elem);
+        }
+      else
+        free (fd);
+    }
+
+  palloc_free_page (kfile);
+  return handle;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  int size;
+
+  lock_acquire (&filesys_lock);
+  size = file_length (fd->file);
+  lock_release (&filesys_lock);
+
+  return size;
+}
+
+/* Read system call.  The buffer is processed a page at a time,
+   pinning each page so that the file system lock is never held
+   across a page fault. */
+static int
+sys_read (int handle, void *udst_, unsigned size)
+{
+  uint8_t *udst = udst_;
+  struct file_descriptor *fd;
+  int bytes_read = 0;
+
+  if (handle == STDIN_FILENO)
+    {
+      for (; size > 0; size--, udst++, bytes_read++)
+        {
+          uint8_t c = input_getc ();
+          pin_page (udst, true);
+          *udst = c;
+          unpin_page (udst);
+        }
+      return bytes_read;
+    }
+
+  fd = lookup_fd (handle);
+  while (size > 0)
+    {
+      size_t page_left = PGSIZE - pg_ofs (udst);
+      size_t read_amt = size < page_left ? size : page_left;
+      off_t retval;
+
+      pin_page (udst, true);
+      lock_acquire (&filesys_lock);
+      retval = file_read (fd->file, udst, read_amt);
+      lock_release (&filesys_lock);
+      unpin_page (udst);
+
+      if (retval < 0)
+        {
+          if (bytes_read == 0)
+            bytes_read = -1;
+          break;
+        }
+      bytes_read += retval;
+      if (retval != (off_t) read_amt)
+        break;
+
+      udst += retval;
+      size -= retval;
+    }
+
+  return bytes_read;
+}
+
+/* Write system call.  Like sys_read(), works a page at a
+   time. */
+static int
+sys_write (int handle, const void *usrc_, unsigned size)
+{
+  const uint8_t *usrc = usrc_;
+  struct file_descriptor *fd = NULL;
+  int bytes_written = 0;
+
+  if (handle != STDOUT_FILENO)
+    fd = lookup_fd (handle);
+
+  while (size > 0)
+    {
+      size_t page_left = PGSIZE - pg_ofs (usrc);
+      size_t write_amt = size < page_left ? size : page_left;
+      off_t retval;
+
+      pin_page (usrc, false);
+      if (handle == STDOUT_FILENO)
+        {
+          putbuf ((const char *) usrc, write_amt);
+          retval = write_amt;
+        }
+      else
+        {
+          lock_acquire (&filesys_lock);
+          retval = file_write (fd->file, usrc, write_amt);
+          lock_release (&filesys_lock);
+        }
+      unpin_page (usrc);
+
+      if (retval < 0)
+        {
+          if (bytes_written == 0)
+            bytes_written = -1;
+          break;
+        }
+      bytes_written += retval;
+      if (retval != (off_t) write_amt)
+        break;
+
+      usrc += retval;
+      size -= retval;
+    }
+
+  return bytes_written;
+}
+
+/* Seek system call. */
+static void
+sys_seek (int handle, unsigned position)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+
+  lock_acquire (&filesys_lock);
+  if ((off_t) position >= 0)
+    file_seek (fd->file, position);
+  lock_release (&filesys_lock);
+}
+
+/* Tell system call. */
+static int
+sys_tell (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  unsigned position;
+
+  lock_acquire (&filesys_lock);
+  position = file_tell (fd->file);
+  lock_release (&filesys_lock);
+
+  return position;
+}
+
+/* Close system call. */
+static void
+sys_close (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+
+  lock_acquire (&filesys_lock);
+  file_close (fd->file);
+  lock_release (&filesys_lock);
+  list_remove (&fd->elem);
+  free (fd);
+}
+
+#ifdef VM
+/* Mmap system call.  The file is only recorded in the page
+   table here; its pages are read as they are touched. */
+static int
+sys_mmap (int handle, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct file_descriptor *fd = NULL;
+  struct list_elem *e;
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  for (e = list_begin (&cur->files); e != list_end (&cur->files);
+       e = list_next (e))
+    {
+      struct file_descriptor *candidate
+        = list_entry (e, struct file_descriptor, elem);
+      if (candidate->handle == handle)
+        fd = candidate;
+    }
+  if (fd == NULL || addr == NULL || pg_ofs (addr) != 0)
+    return -1;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+
+  /* Use a separate file so that the mapping outlives FD. */
+  lock_acquire (&filesys_lock);
+  m->file = file_reopen (fd->file);
+  length = m->file != NULL ? file_length (m->file) : 0;
+  lock_release (&filesys_lock);
+  if (length == 0)
+    goto fail;
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  /* The whole range must be free user address space, outside the
+     area reserved for the stack to grow into. */
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      uint8_t *upage = m->base + i * PGSIZE;
+      if (!is_user_vaddr (upage) || upage < m->base
+          || (size_t) ((uint8_t *) PHYS_BASE - upage) <= page_stack_limit
+          || page_lookup (upage) != NULL)
+        goto fail;
+    }
+
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      uint32_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_record_mmap (m->base + ofs, m->file, ofs, read_bytes))
+        {
+          page_remove_range (m->base, i);
+          goto fail;
+        }
+    }
+
+  m->handle = cur->next_handle++;
+  list_push_front (&cur->mappings, &m->elem);
+  return m->handle;
+
+ fail:
+  lock_acquire (&filesys_lock);
+  file_close (m->file);
+  lock_release (&filesys_lock);
+  free (m);
+  return -1;
+}
+
+/* Munmap system call. */
+static void
+sys_munmap (int mapping)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->handle == mapping)
+        {
+          unmap (m);
+          return;
+        }
+    }
+  sys_exit (-1);
+}
+
+/* Removes mapping M from the current process, writing back its
+   modified pages, and frees it. */
+static void
+unmap (struct mapping *m)
+{
+  page_remove_range (m->base, m->page_cnt);
+
+  lock_acquire (&filesys_lock);
+  file_close (m->file);
+  lock_release (&filesys_lock);
+  list_remove (&m->elem);
+  free (m);
+}
+#endif
+
+/* User memory access.
+
+   int get_user (const uint8_t *uaddr);
+
+     Reads a byte at user virtual address UADDR, which must be
+     below PHYS_BASE.  Returns the byte value if successful, -1
+     if a segfault occurred.
+
+   int put_user (uint8_t *udst, uint8_t byte);
+
+     Writes BYTE to user virtual address UDST, which must be
+     below PHYS_BASE.  Returns 0 if successful, -1 if a segfault
+     occurred.
+
+   Each loads the address to resume at into %eax before touching
+   user memory.  For a fault that page_in() can't resolve, the
+   page fault handler jumps there with -1 in %eax, but only if
+   the faulting instruction lies between user_access_start and
+   user_access_end, so that any other kernel fault on a user
+   address still panics. */
+asm (".pushsection .text\n"
+     ".globl user_access_start, user_access_end, get_user, put_user\n"
+     "user_access_start:\n"
+     "get_user:\n"
+     "  movl 4(%esp), %edx\n"
+     "  movl $1f, %eax\n"
+     "  movzbl (%edx), %eax\n"
+     "1:ret\n"
+     "put_user:\n"
+     "  movl 4(%esp), %edx\n"
+     "  movl 8(%esp), %ecx\n"
+     "  movl $1f, %eax\n"
+     "  movb %cl, (%edx)\n"
+     "  xorl %eax, %eax\n"
+     "1:ret\n"
+     "user_access_end:\n"
+     ".popsection");
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Kills the process if any of the user memory is invalid. */
+static void
+copy_in (void *dst_, const void *usrc_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+
+  for (; size > 0; size--, dst++, usrc++)
+    {
+      int c;
+
+      if (!is_user_vaddr (usrc) || (c = get_user (usrc)) < 0)
+        sys_exit (-1);
+      *dst = c;
+    }
+}
+
+/* Creates a copy of user string US in kernel memory and returns
+   it as a page that must be freed with palloc_free_page().
+   Truncates the string at PGSIZE bytes.  Kills the process if
+   any of the user memory is invalid or if memory allocation
+   fails. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks;
+  size_t length;
+
+  ks = palloc_get_page (0);
+  if (ks == NULL)
+    sys_exit (-1);
+
+  for (length = 0; length < PGSIZE; length++)
+    {
+      const uint8_t *uaddr = (const uint8_t *) us + length;
+      int c;
+
+      if (!is_user_vaddr (uaddr) || (c = get_user (uaddr)) < 0)
+        {
+          palloc_free_page (ks);
+          sys_exit (-1);
+        }
+      ks[length] = c;
+      if (c == '\0')
+        return ks;
+    }
+  ks[PGSIZE - 1] = '\0';
+  return ks;
+}
+
+/* Makes sure that the page containing user address UADDR is
+   accessible to the current process, and writable if WRITE is
+   true, and that it stays in memory until unpin_page().  Kills
+   the process if not. */
+static void
+pin_page (const void *uaddr, bool write)
+{
+  if (!is_user_vaddr (uaddr))
+    sys_exit (-1);
+#ifdef VM
+  if (!page_pin (uaddr, write))
+    sys_exit (-1);
+#else
+  /* Without virtual memory, every valid page stays in memory
+     anyway, so it only needs to be checked.  Writing back the
+     byte just read detects a read-only page. */
+  {
+    int c = get_user (uaddr);
+    if (c < 0)
+      sys_exit (-1);
+    if (write && put_user ((uint8_t *) uaddr, c) < 0)
+      sys_exit (-1);
+  }
+#endif
+}
+
+/* Releases the page pinned by pin_page() for UADDR. */
+static void
+unpin_page (const void *uaddr UNUSED)
+{
+#ifdef VM
+  page_unpin (uaddr);
+#endif
+}
+
+/* Returns the file descriptor associated with the given handle.
+   Terminates the process if HANDLE is not associated with an
+   open file. */
+static struct file_descriptor *
+lookup_fd (int handle)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->files); e != list_end (&cur->files);
+       e = list_next (e))
+    {
+      struct file_descriptor *fd;
+      fd = list_entry (e, struct file_descriptor, elem);
+      if (fd->handle == handle)
+        return fd;
+    }
+
+  sys_exit (-1);
+}
@@ -1,6 +1,20 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct thread;
+
+/* Serializes file system access. */
+extern struct lock filesys_lock;
+
+/* Bounds of the code that reads and writes user memory on the
+   kernel's behalf, where a page fault is not a kernel bug. */
+extern char user_access_start[], user_access_end[];
+
 void syscall_init (void);
+bool syscall_fork (struct thread *parent);
+void syscall_exit (void);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,808 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/policy.h"
+
+/* Frame table.
+
+   Every frame in the user pool that holds a user page is in the
+   frame table, which records the pages held in it.  There is
+   usually just one, but frames are shared copy-on-write after
+   fork().  Frames come from the user pool alone, never borrowed
+   from the kernel pool, because the kernel can't evict its own
+   pages to get memory back, and because the pageout watermarks
+   below only count the user pool.  When the user pool runs dry,
+   a frame is taken from another page.  Which one is up to the
+   replacement policy chosen with -vm-policy, which keeps the
+   frames in the table in an order of its own (see
+   vm/policy.c).
+
+   frame_lock protects the table and the policy, but is never held
+   across I/O.  A frame is claimed for eviction by taking the
+   locks of all of its pages, which keeps their owners from
+   faulting them back in, or destroying them, in the middle of
+   eviction.  The locks are only ever tried while frame_lock is
+   held, so there is no lock ordering problem with page_in(),
+   which holds a page lock while it allocates a frame.  Frames
+   with a page that the kernel has pinned are never chosen.
+
+   A frame's list of pages changes only with frame_lock held and
+   with the lock of one of its pages held, so holding either
+   frame_lock or all of the pages' locks keeps it stable.  The
+   page cache is the exception: a page joins a frame found there
+   with only its own lock held.  That is safe because a frame
+   being evicted is never joined, and the new page's lock keeps
+   the frame from being chosen afterward.
+
+   The page cache holds frames with pages of executables that are
+   read-only, keyed by inode and offset, so that every process
+   running the same program shares one copy of its code.  Such a
+   frame is never modified, so it is simply dropped, and leaves
+   the cache, when it is evicted or when the last process using
+   it exits.
+
+   The page cache also holds the frames of memory-mapped files,
+   so that all the mappings of the same part of a file, in any
+   number of processes, share one frame, writable, and see each
+   other's changes at once.  The frame is modified if any of the
+   PTEs that map it is dirty.  It is written back to the file
+   when it is evicted, if it is modified, and by each mapping
+   that goes away while its own PTE is dirty.
+
+   A frame in the page cache that is being evicted stays in the
+   cache until eviction is over.  A process that looks up the
+   same data in the meantime waits for it, because if the frame
+   is being written back, the file does not hold the data yet.
+
+   Finally, there is the zero frame, a page of zeros that every
+   zero-filled page that has been read but not yet written maps
+   read-only.  It is not in the frame table, so it is never
+   evicted, and it holds a reference to itself, so it is never
+   freed.  Writing to such a page copies the zero frame like any
+   other shared frame.
+
+   Writing a modified page to swap is much slower than dropping
+   an unmodified one, so when the policy chooses a modified page,
+   up to EVICT_CLUSTER - 1 more modified pages that have not been
+   accessed recently are evicted along with it.  The swap code
+   gives them adjacent slots, so the evicting thread writes them
+   one after another to ascending sectors, though still a page
+   at a time, and the frames that aren't needed right away go
+   back to the user pool for the faults that follow.
+
+   Evicting in the faulting thread makes that thread wait for the
+   sweep and for any swap I/O, so a "pageout" kernel thread tries
+   to stay ahead of demand.  Whenever a frame is allocated with
+   fewer than low_water pages left free in the user pool, the
+   thread is woken up and evicts pages, in clusters as above,
+   until high_water pages are free.  A faulting thread evicts
+   pages itself only when the pool runs dry anyway. */
+
+/* Maximum number of pages evicted at once. */
+#define EVICT_CLUSTER 8
+
+/* Low watermark for the pageout thread, as a percentage of the
+   user pool.  The high watermark is twice as high.  0 disables
+   the thread.  Set with the -pageout kernel command line
+   option. */
+unsigned frame_pageout_pct = 3;
+
+/* Free user pool pages below which the pageout thread is woken
+   up and up to which it evicts pages. */
+static size_t low_water, high_water;
+
+/* Wakes up the pageout thread. */
+static struct semaphore pageout_sema;
+
+/* Signaled, with frame_lock, whenever a frame in the page cache
+   has been evicted or could not be. */
+static struct condition evict_cond;
+
+/* True while the pageout thread has been woken up and has not
+   finished.  Changed only with interrupts off. */
+static bool pageout_busy;
+
+/* Page cache: frames in the table that hold read-only pages of
+   files, keyed by inode and offset. */
+static struct hash page_cache;
+
+/* Protects the frame table, the replacement policy, PAGE_CACHE,
+   and the statistics below. */
+static struct lock frame_lock;
+
+/* The zero frame. */
+static struct frame zero_frame;
+
+/* Cache of struct frame. */
+static struct kmem_cache frame_cache;
+
+/* Statistics. */
+static size_t frame_cnt;                /* Frames in the table. */
+static size_t peak_frame_cnt;           /* Maximum of frame_cnt. */
+static long long evict_cnt;             /* Frames evicted. */
+static long long cluster_cnt;           /* Evictions of more than one. */
+static long long evict_fail_cnt;        /* Evictions that found nothing. */
+static long long share_cnt;             /* Pages added to shared frames. */
+static size_t cached_cnt;               /* Frames in the page cache. */
+static long long cache_hit_cnt;         /* Lookups that found a frame. */
+static long long cache_miss_cnt;        /* Lookups that didn't. */
+static long long pageout_wake_cnt;      /* Wakeups of pageout thread. */
+static long long pageout_cnt;           /* Frames it evicted. */
+
+static struct frame *new_frame (void);
+static void destroy_frame (struct frame *);
+static void install (struct frame *, struct page *);
+static void remove_frame (struct frame *);
+static void uncache (struct frame *);
+static void claim_victim (struct frame *);
+static void finish_eviction (struct frame *, bool evicted);
+static struct frame *evict (void);
+static bool evict_cluster (struct frame **keep, size_t *out_cnt);
+static void wake_pageout (void);
+static thread_func pageout_thread NO_RETURN;
+static size_t choose_victims (struct frame *[EVICT_CLUSTER]);
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  size_t user_cnt;
+
+  lock_init (&frame_lock);
+  cond_init (&evict_cond);
+  kmem_cache_init (&frame_cache, "frame", sizeof (struct frame), NULL, NULL);
+  if (!hash_init (&page_cache, cache_hash, cache_less, NULL))
+    PANIC ("frame: can't allocate page cache");
+
+  zero_frame.kpage = palloc_get_page (PAL_USER | PAL_ZERO | PAL_NOBORROW);
+  if (zero_frame.kpage == NULL)
+    PANIC ("frame: can't allocate zero frame");
+  list_init (&zero_frame.pages);
+  zero_frame.ref_cnt = 1;
+  zero_frame.cached = false;
+  zero_frame.evicting = false;
+
+  user_cnt = palloc_free_cnt (PAL_USER);
+  frame_policy->init (user_cnt);
+  low_water = user_cnt * frame_pageout_pct / 100;
+  high_water = 2 * low_water;
+  sema_init (&pageout_sema, 0);
+  if (low_water > 0
+      && thread_create ("pageout", PRI_DEFAULT, pageout_thread, NULL)
+         == TID_ERROR)
+    PANIC ("frame: can't start pageout thread");
+}
+
+/* Obtains a frame for PAGE, which belongs to the current
+   process, evicting other pages if the user pool is empty.  The
+   caller must hold PAGE's lock and is responsible for filling
+   the frame and mapping it.  Returns a null pointer if no frame
+   is available. */
+struct frame *
+frame_alloc (struct page *page)
+{
+  struct frame *f = new_frame ();
+  if (f == NULL)
+    {
+      f = evict ();
+      if (f == NULL)
+        return NULL;
+    }
+  install (f, page);
+  return f;
+}
+
+/* Obtains a new frame for PAGE, which belongs to the current
+   process and is held in the shared frame F, copies F into it,
+   and moves PAGE from F to the new frame.  Otherwise like
+   frame_alloc().  PAGE may still be mapped to F, but once PAGE
+   has left F, F may be evicted, so the caller must map PAGE to
+   the new frame before its process can touch it again. */
+struct frame *
+frame_copy (struct frame *f, struct page *page)
+{
+  struct frame *copy;
+
+  /* F can't be evicted in the meantime: we hold PAGE's lock. */
+  copy = new_frame ();
+  if (copy == NULL)
+    {
+      copy = evict ();
+      if (copy == NULL)
+        return NULL;
+    }
+  memcpy (copy->kpage, f->kpage, PGSIZE);
+  frame_release (f, page);
+  install (copy, page);
+  return copy;
+}
+
+/* Like frame_alloc(), but returns a null pointer instead of
+   evicting any page. */
+struct frame *
+frame_try_alloc (struct page *page)
+{
+  struct frame *f = new_frame ();
+  if (f != NULL)
+    install (f, page);
+  return f;
+}
+
+/* Adds PAGE, which belongs to the current process, to the pages
+   held in F.  The caller must hold the lock of a page already
+   held in F, which keeps F from being evicted, and is
+   responsible for mapping F read-only in every page that holds
+   it. */
+void
+frame_share (struct frame *f, struct page *page)
+{
+  lock_acquire (&frame_lock);
+  if (page->ghost != 0)
+    frame_policy->forget (page);
+  list_push_back (&f->pages, &page->frame_elem);
+  f->ref_cnt++;
+  share_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Removes PAGE from the pages held in F.  If it was the last
+   one, removes F from the frame table and frees it along with
+   its page of memory.  The caller must hold PAGE's lock, and
+   PAGE must no longer be mapped. */
+void
+frame_release (struct frame *f, struct page *page)
+{
+  bool last;
+
+  ASSERT (lock_held_by_current_thread (&page->lock));
+
+  lock_acquire (&frame_lock);
+  list_remove (&page->frame_elem);
+  last = --f->ref_cnt == 0;
+  if (last)
+    remove_frame (f);
+  lock_release (&frame_lock);
+
+  if (last)
+    destroy_frame (f);
+}
+
+/* Adds PAGE, which belongs to the current process and must not
+   be resident, to the pages of the zero frame and returns the
+   zero frame.  The caller must hold PAGE's lock and is
+   responsible for mapping the zero frame read-only. */
+struct frame *
+frame_zero (struct page *page)
+{
+  ASSERT (lock_held_by_current_thread (&page->lock));
+
+  lock_acquire (&frame_lock);
+  if (page->ghost != 0)
+    frame_policy->forget (page);
+  list_push_back (&zero_frame.pages, &page->frame_elem);
+  zero_frame.ref_cnt++;
+  lock_release (&frame_lock);
+
+  return &zero_frame;
+}
+
+/* Looks in the page cache for a frame holding the contents of
+   PAGE, a read-only page of an executable or a page of a
+   memory-mapped file, whose lock must be held.  If there is one,
+   adds PAGE to its pages and returns it, and the caller is
+   responsible for mapping it, read-only in the former case.
+   Otherwise, returns a null pointer.  If the frame found is
+   being evicted, waits for eviction to finish and looks again if
+   WAIT is true, or returns a null pointer if WAIT is false. */
+struct frame *
+frame_cache_lookup (struct page *page, bool wait)
+{
+  struct frame key;
+  struct hash_elem *e;
+  struct frame *f = NULL;
+
+  ASSERT (lock_held_by_current_thread (&page->lock));
+
+  key.inode = file_get_inode (page->file);
+  key.ofs = page->file_ofs;
+  key.read_bytes = page->read_bytes;
+  key.mapped = page->write_back;
+
+  lock_acquire (&frame_lock);
+  while ((e = hash_find (&page_cache, &key.cache_elem)) != NULL)
+    {
+      f = hash_entry (e, struct frame, cache_elem);
+      if (!f->evicting)
+        {
+          if (page->ghost != 0)
+            frame_policy->forget (page);
+          list_push_back (&f->pages, &page->frame_elem);
+          f->ref_cnt++;
+          break;
+        }
+      f = NULL;
+      if (!wait)
+        break;
+      cond_wait (&evict_cond, &frame_lock);
+    }
+  if (f != NULL)
+    cache_hit_cnt++;
+  else
+    cache_miss_cnt++;
+  lock_release (&frame_lock);
+
+  return f;
+}
+
+/* Adds F, which holds PAGE, a read-only page of an executable or
+   a page of a memory-mapped file, just read from its file, to
+   the page cache.  Returns true if successful, false if another
+   process got there first. */
+bool
+frame_cache_insert (struct frame *f, struct page *page)
+{
+  bool success;
+
+  ASSERT (lock_held_by_current_thread (&page->lock));
+
+  f->inode = file_get_inode (page->file);
+  f->ofs = page->file_ofs;
+  f->read_bytes = page->read_bytes;
+  f->mapped = page->write_back;
+
+  lock_acquire (&frame_lock);
+  success = hash_insert (&page_cache, &f->cache_elem) == NULL;
+  if (success)
+    {
+      f->cached = true;
+      cached_cnt++;
+    }
+  lock_release (&frame_lock);
+
+  return success;
+}
+
+/* Makes the replacement policy forget that PAGE, which belongs to
+   the current process and is being freed, was evicted.  The
+   caller must hold PAGE's lock. */
+void
+frame_forget (struct page *page)
+{
+  ASSERT (lock_held_by_current_thread (&page->lock));
+
+  /* A page only becomes a ghost while its lock is held, so if we
+     see it is not one, it isn't. */
+  if (page->ghost != 0)
+    {
+      lock_acquire (&frame_lock);
+      if (page->ghost != 0)
+        frame_policy->forget (page);
+      lock_release (&frame_lock);
+    }
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frame: %zu frames in use (peak %zu), %lld evicted "
+          "(%lld in clusters), %lld evictions failed, "
+          "%lld pages shared\n",
+          frame_cnt, peak_frame_cnt, evict_cnt, cluster_cnt,
+          evict_fail_cnt, share_cnt);
+  printf ("Frame: %zu frames in page cache, %lld hits, %lld misses\n",
+          cached_cnt, cache_hit_cnt, cache_miss_cnt);
+  printf ("Frame: %u pages map the zero frame\n", zero_frame.ref_cnt - 1);
+  printf ("Frame: pageout thread woken %lld times, %lld frames evicted "
+          "in background, watermarks %zu/%zu pages\n",
+          pageout_wake_cnt, pageout_cnt, low_water, high_water);
+  frame_policy->print_stats ();
+}
+
+/* Returns a new frame with a page from the user pool, or a null
+   pointer if none is available. */
+static struct frame *
+new_frame (void)
+{
+  struct frame *f;
+  void *kpage;
+
+  kpage = palloc_get_page (PAL_USER | PAL_NOBORROW);
+  if (palloc_free_cnt (PAL_USER) < low_water)
+    wake_pageout ();
+  if (kpage == NULL)
+    return NULL;
+  f = kmem_cache_alloc (&frame_cache);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  return f;
+}
+
+/* Frees F, which must not be in the frame table, and its page. */
+static void
+destroy_frame (struct frame *f)
+{
+  palloc_free_page (f->kpage);
+  kmem_cache_free (&frame_cache, f);
+}
+
+/* Adds F to the frame table as holding only PAGE. */
+static void
+install (struct frame *f, struct page *page)
+{
+  list_init (&f->pages);
+  list_push_back (&f->pages, &page->frame_elem);
+  f->ref_cnt = 1;
+  f->cached = false;
+  f->evicting = false;
+
+  lock_acquire (&frame_lock);
+  frame_policy->add (f, page);
+  if (++frame_cnt > peak_frame_cnt)
+    peak_frame_cnt = frame_cnt;
+  lock_release (&frame_lock);
+}
+
+/* Removes F from the frame table and the page cache.
+   frame_lock must be held. */
+static void
+remove_frame (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  frame_policy->remove (f);
+  frame_cnt--;
+  uncache (f);
+}
+
+/* Removes F from the page cache, if it is there.  frame_lock
+   must be held. */
+static void
+uncache (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (f->cached)
+    {
+      hash_delete (&page_cache, &f->cache_elem);
+      f->cached = false;
+      cached_cnt--;
+    }
+}
+
+/* Removes F, which has been chosen for eviction, from the frame
+   table.  If F is in the page cache, it stays there until
+   finish_eviction().  frame_lock must be held. */
+static void
+claim_victim (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  frame_policy->remove (f);
+  frame_cnt--;
+  f->evicting = true;
+}
+
+/* Ends the eviction of F, which claim_victim() removed from the
+   frame table.  If EVICTED is true, F was evicted and leaves the
+   page cache.  Otherwise, F is put back into the frame table.
+   Either way, processes waiting for F in frame_cache_lookup()
+   may go on.  frame_lock must be held. */
+static void
+finish_eviction (struct frame *f, bool evicted)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  f->evicting = false;
+  if (evicted)
+    uncache (f);
+  else
+    {
+      frame_policy->add (f, NULL);
+      frame_cnt++;
+    }
+  cond_broadcast (&evict_cond, &frame_lock);
+}
+
+/* Evicts one or more pages and returns the frame of one of
+   them, removed from the frame table.  The frames of the others
+   are freed.  Returns a null pointer if no page can be
+   evicted. */
+static struct frame *
+evict (void)
+{
+  struct frame *f = NULL;
+  size_t out_cnt = 0;
+  size_t try_cnt;
+
+  lock_acquire (&frame_lock);
+  for (try_cnt = frame_cnt; f == NULL && try_cnt > 0; try_cnt--)
+    if (!evict_cluster (&f, &out_cnt))
+      break;
+  if (f == NULL)
+    evict_fail_cnt++;
+  lock_release (&frame_lock);
+
+  return f;
+}
+
+/* Chooses a cluster of frames with choose_victims() and evicts
+   as many of them as possible, adding the number evicted to
+   *OUT_CNT.  If KEEP is nonnull and *KEEP is null, the first
+   frame evicted is stored in *KEEP, removed from the frame
+   table; the other frames are freed.  Returns false if no frame
+   could be chosen.  frame_lock must be held on entry and is held
+   on return, but it is released in between. */
+static bool
+evict_cluster (struct frame **keep, size_t *out_cnt)
+{
+  struct frame *victims[EVICT_CLUSTER];
+  size_t victim_cnt;
+  size_t evicted = 0;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  victim_cnt = choose_victims (victims);
+  if (victim_cnt == 0)
+    return false;
+
+  /* Evict without holding frame_lock, so that other threads can
+     use the table in the meantime. */
+  lock_release (&frame_lock);
+  for (i = 0; i < victim_cnt; i++)
+    {
+      struct frame *v = victims[i];
+      bool success = page_out (v);
+
+      /* If the frame can't be evicted, put it back before
+         releasing its pages' locks, because their owners might
+         free the frame as soon as we do. */
+      if (!success || v->cached)
+        {
+          lock_acquire (&frame_lock);
+          finish_eviction (v, success);
+          lock_release (&frame_lock);
+        }
+      frame_unlock_pages (v);
+
+      if (success)
+        {
+          if (keep != NULL && *keep == NULL)
+            *keep = v;
+          else
+            destroy_frame (v);
+          evicted++;
+        }
+    }
+  lock_acquire (&frame_lock);
+
+  evict_cnt += evicted;
+  if (evicted > 1)
+    cluster_cnt++;
+  *out_cnt += evicted;
+  return true;
+}
+
+/* Wakes up the pageout thread, unless it is already awake. */
+static void
+wake_pageout (void)
+{
+  enum intr_level old_level = intr_disable ();
+  if (!pageout_busy)
+    {
+      pageout_busy = true;
+      sema_up (&pageout_sema);
+    }
+  intr_set_level (old_level);
+}
+
+/* The pageout thread.  Each time it is woken up, it evicts pages
+   until high_water pages of the user pool are free, or until it
+   has gone around the frame table once, or until it fails to
+   evict anything. */
+static void
+pageout_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      size_t out_cnt = 0;
+      size_t try_cnt;
+
+      sema_down (&pageout_sema);
+
+      lock_acquire (&frame_lock);
+      pageout_wake_cnt++;
+      for (try_cnt = frame_cnt; try_cnt > 0; try_cnt--)
+        {
+          size_t before = out_cnt;
+
+          if (palloc_free_cnt (PAL_USER) >= high_water
+              || !evict_cluster (NULL, &out_cnt)
+              || out_cnt == before)
+            break;
+        }
+      pageout_cnt += out_cnt;
+      lock_release (&frame_lock);
+
+      old_level = intr_disable ();
+      pageout_busy = false;
+      intr_set_level (old_level);
+    }
+}
+
+/* Chooses frames to evict with the replacement policy, removes
+   them from the frame table, and stores them in VICTIMS.
+   Returns the number of frames chosen, which is 0 if none can
+   be.  The pages of each chosen frame are locked on return.
+   frame_lock must be held. */
+static size_t
+choose_victims (struct frame *victims[EVICT_CLUSTER])
+{
+  struct frame *f;
+  size_t victim_cnt;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  f = frame_policy->choose ();
+  if (f == NULL)
+    return 0;
+  claim_victim (f);
+  victims[0] = f;
+  victim_cnt = 1;
+
+  /* If F has to go to swap, take along other modified pages that
+     have not been accessed lately. */
+  if (frame_is_dirty (f))
+    while (victim_cnt < EVICT_CLUSTER)
+      {
+        struct frame *c = frame_policy->choose_dirty ();
+        if (c == NULL)
+          break;
+        claim_victim (c);
+        victims[victim_cnt++] = c;
+      }
+
+  return victim_cnt;
+}
+
+/* Tries to lock each of the pages held in F, without waiting.
+   Returns true if successful, false if any of them is busy or
+   pinned, in which case none of them is left locked.  frame_lock
+   must be held. */
+bool
+frame_lock_pages (struct frame *f)
+{
+  struct list_elem *e, *failed;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+
+      /* We may be allocating a frame for a page of our own that
+         shares F, so its lock may be ours already. */
+      if (lock_held_by_current_thread (&p->lock)
+          || !lock_try_acquire (&p->lock))
+        break;
+      if (p->pinned)
+        {
+          lock_release (&p->lock);
+          break;
+        }
+    }
+  if (e == list_end (&f->pages))
+    return true;
+
+  failed = e;
+  for (e = list_begin (&f->pages); e != failed; e = list_next (e))
+    lock_release (&list_entry (e, struct page, frame_elem)->lock);
+  return false;
+}
+
+/* Releases the locks of the pages held in F. */
+void
+frame_unlock_pages (struct frame *f)
+{
+  struct list_elem *e, *next;
+
+  /* Once a page is unlocked, its owner may free it, so step past
+     it first. */
+  for (e = list_begin (&f->pages); e != list_end (&f->pages); e = next)
+    {
+      next = list_next (e);
+      lock_release (&list_entry (e, struct page, frame_elem)->lock);
+    }
+}
+
+/* Returns true if any of the pages held in F has been accessed
+   since its accessed bit was last cleared. */
+bool
+frame_is_accessed (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      if (pagedir_is_accessed (p->pagedir, p->upage))
+        return true;
+    }
+  return false;
+}
+
+/* Clears the accessed bits of the pages held in F. */
+void
+frame_clear_accessed (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      pagedir_set_accessed (p->pagedir, p->upage, false);
+    }
+}
+
+/* Returns true if any of the pages held in F has been modified,
+   that is, if F differs from what is on disk. */
+bool
+frame_is_dirty (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      if (pagedir_is_dirty (p->pagedir, p->upage))
+        return true;
+    }
+  return false;
+}
+
+/* Returns a hash value for the page cache frame that E refers
+   to. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, cache_elem);
+  return hash_int ((uintptr_t) f->inode ^ f->ofs);
+}
+
+/* Returns true if page cache frame A precedes B. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, cache_elem);
+  const struct frame *b = hash_entry (b_, struct frame, cache_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else if (a->read_bytes != b->read_bytes)
+    return a->read_bytes < b->read_bytes;
+  else
+    return a->mapped < b->mapped;
+}
@@ -0,0 +1,54 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct inode;
+struct page;
+
+/* A frame: a page from the user pool holding a user page.
+
+   A frame usually holds a single process's page, but after
+   fork() it may be shared, read-only, by the corresponding pages
+   of several processes until one of them writes to it.  A frame
+   in the page cache holds read-only executable data, or data of
+   a memory-mapped file, and is shared by every process that maps
+   it, writable in the latter case. */
+struct frame
+  {
+    void *kpage;                /* Kernel virtual address. */
+    struct list pages;          /* Pages held in this frame. */
+    unsigned ref_cnt;           /* Number of elements in PAGES. */
+    struct list_elem elem;      /* Element in a replacement policy queue. */
+    int queue;                  /* Queue holding this frame. */
+    bool fresh;                 /* Accessed only by the fault so far? */
+
+    /* Page cache. */
+    bool cached;                /* In the page cache? */
+    bool evicting;              /* Chosen for eviction? */
+    struct hash_elem cache_elem; /* Element in page cache. */
+    struct inode *inode;        /* Inode whose data this is... */
+    off_t ofs;                  /* ...starting at this offset... */
+    uint32_t read_bytes;        /* ...for this many bytes... */
+    bool mapped;                /* ...mapped with mmap()? */
+  };
+
+extern unsigned frame_pageout_pct;
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *);
+struct frame *frame_try_alloc (struct page *);
+struct frame *frame_copy (struct frame *, struct page *);
+struct frame *frame_zero (struct page *);
+void frame_share (struct frame *, struct page *);
+void frame_release (struct frame *, struct page *);
+struct frame *frame_cache_lookup (struct page *, bool wait);
+bool frame_cache_insert (struct frame *, struct page *);
+void frame_forget (struct page *);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,1117 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process has a hash table of struct page, keyed by user
+   virtual page, that describes every page in its address space.
+   Executables are loaded lazily: load() only records where each
+   page's contents come from, and a page is read or zeroed the
+   first time it is touched, in page_in(), called from the page
+   fault handler.  Pages that a program never touches are never
+   read from disk and never take up a frame.
+
+   When the frame table evicts a page that has been modified, its
+   contents go to swap, and from then on it is a PAGE_SWAP page.
+   Once read back in, a page keeps its swap slot, so that it can
+   be evicted again without any I/O as long as it stays
+   unmodified.  Unmodified pages of the other types are simply
+   dropped and later read or zeroed again.
+
+   Pages of memory-mapped files are different: they are written
+   back to their file, not to swap, and only if modified.  All
+   the mappings of the same part of a file, in this process or
+   any other, share one frame through the frame table's page
+   cache, writable by all of them, so each sees the others'
+   changes as soon as they are made, and writing the frame back
+   saves the changes of all of them.
+
+   A zero-filled page that is read before it is ever written is
+   mapped read-only to the frame table's shared zero frame, so
+   big arrays that are only partly used cost no memory for the
+   rest.  The first write copies it, like any other shared
+   frame.
+
+   Read-only pages of executables are shared by all the
+   processes that run the same program, through the frame
+   table's page cache.  The first process to touch such a page
+   reads it and the others find it there.
+
+   fork() copies the page table, not the pages.  Resident pages
+   are shared copy-on-write: parent and child map the same frame
+   read-only, and the first one to write to it takes a copy in
+   page_in(), or simply takes the frame back for itself if
+   nobody else uses it any more.  Pages in swap share their slot
+   in the same way.  Whether a frame differs from its page's
+   file lives only in the dirty bits of the PTEs that map it, so
+   a shared frame's pages all inherit the dirty bit of the page
+   it was shared from.
+
+   A process's stack starts out as a single page and grows on
+   demand: a fault on an address that is not in the page table
+   but looks like a stack access adds an anonymous page there.
+   An access looks like a stack access if it is no more than
+   STACK_SLOP bytes below the user stack pointer and within
+   page_stack_limit bytes of the top of user memory.
+
+   A fault on a page of a file also maps the pages of the
+   aligned FAULT_AROUND-page block around it that are already in
+   the page cache, which costs no I/O.  If the process's faults
+   on file pages have been sequential, it also reads ahead the
+   pages that follow, as long as there are free frames.  The
+   readahead window starts at READAHEAD_MIN pages, doubles on
+   each sequential fault up to READAHEAD_MAX, and drops to zero
+   on a fault anywhere else.  Pages read ahead are mapped with
+   their accessed bits clear, so if they go unused, they are the
+   first to be evicted.
+
+   Swapping a page in also reads ahead up to SWAP_READAHEAD pages
+   of the same process from the following swap slots, if free
+   frames are available.  Slots are allocated in order, so these
+   are likely to be pages that were evicted together.
+
+   The time page_in() takes, in CPU cycles, goes into a histogram
+   with power-of-2 buckets, which shows how much of the cost of
+   faults under memory pressure the frame table's pageout thread
+   takes off the faulting threads. */
+
+/* Number of swap slots to read ahead. */
+#define SWAP_READAHEAD 3
+
+/* Size of the block of pages around a file page fault that are
+   mapped if they are in the page cache.  Must be a power of 2. */
+#define FAULT_AROUND 8
+
+/* Bounds on the number of file pages read ahead after a
+   sequential fault. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 16
+
+/* How far below the stack pointer a stack access may be.  The
+   80x86 PUSHA instruction checks access permissions before it
+   adjusts the stack pointer, so it may fault 32 bytes below
+   it. */
+#define STACK_SLOP 32
+
+/* Fault latency histogram: bucket 0 counts faults that took
+   fewer than 2**LATENCY_SHIFT cycles, each following bucket
+   twice as many, and the last bucket everything slower. */
+#define LATENCY_BUCKETS 12
+#define LATENCY_SHIFT 12
+
+/* Maximum size of a user stack, in bytes.  Set with the -stack
+   kernel command line option. */
+size_t page_stack_limit = 8 * 1024 * 1024;
+
+/* Cache of struct page. */
+static struct kmem_cache page_cache;
+
+/* Statistics. */
+static long long record_cnt;            /* Pages recorded. */
+static long long load_cnt[4];           /* Pages brought in, by type. */
+static long long readahead_cnt;         /* Pages read ahead from swap. */
+static long long evict_cnt;             /* Pages evicted. */
+static long long swap_evict_cnt;        /* ...of which written to swap. */
+static long long write_back_cnt;        /* Mapped pages written back. */
+static long long freed_out_cnt;         /* Pages not resident when freed. */
+static size_t resident_cnt;             /* Pages now resident. */
+static size_t peak_resident_cnt;        /* Maximum of resident_cnt. */
+static long long share_cnt;             /* Resident pages shared by fork. */
+static long long cow_copy_cnt;          /* Shared pages copied on write. */
+static long long cow_reuse_cnt;         /* ...or made writable in place. */
+static long long stack_grow_cnt;        /* Pages added to stacks. */
+static long long zero_map_cnt;          /* Pages mapped to zero frame. */
+static long long minor_cnt;             /* Faults handled without I/O. */
+static long long major_cnt;             /* Faults that needed I/O. */
+static long long around_cnt;            /* Cached pages mapped around. */
+static long long file_readahead_cnt;    /* File pages read ahead. */
+static long long latency_hist[LATENCY_BUCKETS]; /* Faults by cycles. */
+
+static struct page *record (void *upage, enum page_type, bool writable,
+                            struct file *, off_t ofs, uint32_t read_bytes);
+static struct page *grow_stack (const void *vaddr);
+static bool fault_in (struct page *, bool write);
+static bool load_page (struct page *);
+static bool map_zero (struct page *);
+static void fault_around (struct page *);
+static bool bring_in_neighbor (uint8_t *upage, bool read);
+static bool read_page (struct page *, uint8_t *kpage);
+static bool share_page (struct page *, struct page *);
+static bool make_private (struct page *);
+static bool is_shareable (const struct page *);
+static bool map_writable (const struct page *, const struct frame *);
+static void prepare_discard (struct page *);
+static void discard_page (struct page *);
+static void write_back (struct page *, const void *kpage);
+static void swap_readahead (size_t slot);
+static void note_latency (uint64_t cycles);
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func destroy_page;
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  kmem_cache_init (&page_cache, "page", sizeof (struct page), NULL, NULL);
+}
+
+/* Initializes the current process's supplemental page table.
+   Returns true if successful, false on memory allocation
+   failure. */
+bool
+page_table_init (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/* Copies PARENT's supplemental page table into the current
+   process's, which must be empty, for fork().  Resident pages
+   are shared copy-on-write and swapped-out pages share their
+   swap slots.  Pages of memory-mapped files are not copied.
+   Pages read from PARENT's executable are read from the current
+   process's executable instead, which must already be open.
+   PARENT must stay blocked until this function returns.
+   Returns true if successful, false on memory allocation
+   failure, in which case the current process's page table may
+   be partly filled in. */
+bool
+page_table_copy (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct hash_iterator i;
+
+  hash_first (&i, &parent->pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct file *file;
+      struct page *c;
+      bool success = true;
+
+      if (p->write_back)
+        continue;
+      file = p->file == parent->exec_file ? cur->exec_file : p->file;
+      c = record (p->upage, p->type, p->writable, file, p->file_ofs,
+                  p->read_bytes);
+      if (c == NULL)
+        return false;
+
+      /* Keep P from being evicted while we copy it. */
+      lock_acquire (&p->lock);
+      c->swap_slot = p->swap_slot;
+      swap_dup (c->swap_slot);
+      if (p->frame != NULL)
+        success = share_page (p, c);
+      lock_release (&p->lock);
+      if (!success)
+        return false;
+    }
+  return true;
+}
+
+/* Destroys the current process's supplemental page table,
+   freeing each resident page's frame.  Must be called while the
+   process's page directory still exists. */
+void
+page_table_destroy (void)
+{
+  struct thread *cur = thread_current ();
+  struct hash_iterator i;
+
+  hash_first (&i, &cur->pages);
+  while (hash_next (&i))
+    prepare_discard (hash_entry (hash_cur (&i), struct page, hash_elem));
+  pagedir_clear_range (cur->pagedir, NULL, (uintptr_t) PHYS_BASE / PGSIZE);
+  hash_destroy (&cur->pages, destroy_page);
+}
+
+/* Records that user virtual page UPAGE in the current process
+   is to be initialized with READ_BYTES bytes read from FILE
+   starting at offset OFS, followed by PGSIZE - READ_BYTES zero
+   bytes.  The page is writable by the process if WRITABLE is
+   true, read-only otherwise.  FILE must stay open as long as
+   the process exists.  Returns true if successful, false if
+   UPAGE is already in use or on memory allocation failure. */
+bool
+page_record_file (void *upage, struct file *file, off_t ofs,
+                  uint32_t read_bytes, bool writable)
+{
+  ASSERT (file != NULL);
+  ASSERT (read_bytes <= PGSIZE);
+
+  return record (upage, PAGE_FILE, writable, file, ofs, read_bytes) != NULL;
+}
+
+/* Records that user virtual page UPAGE in the current process
+   is to be initialized with zeros.  Otherwise like
+   page_record_file(). */
+bool
+page_record_zero (void *upage, bool writable)
+{
+  return record (upage, PAGE_ZERO, writable, NULL, 0, 0) != NULL;
+}
+
+/* Records that user virtual page UPAGE in the current process
+   is anonymous memory, such as stack, which is zeroed when
+   first touched.  Otherwise like page_record_file(). */
+bool
+page_record_anon (void *upage, bool writable)
+{
+  return record (upage, PAGE_ANON, writable, NULL, 0, 0) != NULL;
+}
+
+/* Records that user virtual page UPAGE in the current process
+   is mapped to READ_BYTES bytes of FILE starting at offset OFS,
+   followed by zeros.  The page is writable, and changes to it
+   are written back to FILE.  It shares its frame with every
+   other mapping of the same part of FILE's inode (see the top of
+   this file).  Otherwise like page_record_file(). */
+bool
+page_record_mmap (void *upage, struct file *file, off_t ofs,
+                  uint32_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (file != NULL);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = record (upage, PAGE_FILE, true, file, ofs, read_bytes);
+  if (p == NULL)
+    return false;
+  p->write_back = true;
+  return true;
+}
+
+/* Removes the PAGE_CNT pages starting at UPAGE, which must all
+   exist, from the current process's address space.  Changes to
+   pages of memory-mapped files are written back first.  The
+   pages are unmapped all at once, which takes a single TLB flush
+   if there are many of them. */
+void
+page_remove_range (void *upage, size_t page_cnt)
+{
+  struct thread *cur = thread_current ();
+  uint8_t *base = upage;
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    prepare_discard (page_lookup (base + i * PGSIZE));
+  pagedir_clear_range (cur->pagedir, upage, page_cnt);
+  for (i = 0; i < page_cnt; i++)
+    {
+      struct page *p = page_lookup (base + i * PGSIZE);
+      hash_delete (&cur->pages, &p->hash_elem);
+      discard_page (p);
+    }
+}
+
+/* Returns the page containing user virtual address VADDR in the
+   current process's supplemental page table, or a null pointer
+   if there is none. */
+struct page *
+page_lookup (const void *vaddr)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (vaddr);
+  e = hash_find (&thread_current ()->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Brings the page containing user virtual address VADDR in the
+   current process into memory and maps it, first adding it to
+   the process's stack if VADDR looks like a stack access.  If
+   WRITE is true, also makes sure that the process can write to
+   it, copying it if it is shared with another process.  Returns
+   true if successful, false if VADDR is not part of the
+   process's address space, if WRITE is true and the page is
+   read-only, or if memory allocation or disk read fails.  Does nothing,
+   successfully, if the page is already in memory and, for
+   WRITE, is the process's own. */
+bool
+page_in (const void *vaddr, bool write)
+{
+  uint64_t start = rdtsc ();
+  struct page *p = page_lookup (vaddr);
+  bool success;
+
+  if (p == NULL)
+    p = grow_stack (vaddr);
+  if (p == NULL || (write && !p->writable))
+    return false;
+
+  lock_acquire (&p->lock);
+  success = fault_in (p, write);
+  lock_release (&p->lock);
+
+  note_latency (rdtsc () - start);
+  return success;
+}
+
+/* Evicts the pages held in frame F, unmapping them from their
+   processes' page directories and writing F to swap if it has
+   been modified.  The caller must hold the locks of all of F's
+   pages and must already have removed F from the frame table;
+   the frame itself is left to the caller.  Returns true if
+   successful, false if F cannot be evicted because swap is
+   full. */
+bool
+page_out (struct frame *f)
+{
+  struct page *first = list_entry (list_front (&f->pages),
+                                   struct page, frame_elem);
+  size_t slot = SWAP_NONE;
+  enum intr_level old_level;
+  struct list_elem *e;
+  bool dirty = false;
+
+  /* Check and unmap with interrupts off, so that the owners
+     can't modify the page in between.  Once it is unmapped, an
+     owner can't touch it without faulting, and page_in() waits
+     for our lock. */
+  old_level = intr_disable ();
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+
+      ASSERT (lock_held_by_current_thread (&p->lock));
+      ASSERT (p->frame == f);
+
+      if (pagedir_is_dirty (p->pagedir, p->upage))
+        dirty = true;
+      pagedir_clear_page (p->pagedir, p->upage);
+      pagedir_compact (p->pagedir, p->upage);
+    }
+  intr_set_level (old_level);
+
+  /* If FIRST is a page of a mapped file, so are all the others,
+     mappings of the same data, so writing back FIRST writes back
+     all of them. */
+  if (dirty && first->write_back)
+    write_back (first, f->kpage);
+  else if (dirty)
+    {
+      slot = swap_out (f->kpage, first);
+      if (slot == SWAP_NONE)
+        {
+          /* Put the pages back as they were.  If a page table has
+             been freed in the meantime and can't be allocated
+             again, fault_in() maps the page later instead. */
+          for (e = list_begin (&f->pages); e != list_end (&f->pages);
+               e = list_next (e))
+            {
+              struct page *p = list_entry (e, struct page, frame_elem);
+              pagedir_set_page (p->pagedir, p->upage, f->kpage,
+                                map_writable (p, f));
+              pagedir_set_dirty (p->pagedir, p->upage, true);
+            }
+          return false;
+        }
+    }
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+
+      if (slot != SWAP_NONE)
+        {
+          if (p != first)
+            swap_dup (slot);
+          swap_free (p->swap_slot, p);
+          p->swap_slot = slot;
+          p->type = PAGE_SWAP;
+        }
+      p->frame = NULL;
+    }
+
+  old_level = intr_disable ();
+  resident_cnt -= f->ref_cnt;
+  evict_cnt += f->ref_cnt;
+  if (slot != SWAP_NONE)
+    swap_evict_cnt += f->ref_cnt;
+  intr_set_level (old_level);
+
+  return true;
+}
+
+/* Brings the page containing user virtual address VADDR in the
+   current process into memory, if it isn't already, and keeps
+   it there until page_unpin() is called for it.  The kernel can
+   then access the page without faulting, even while holding
+   locks that the page fault handler needs.  Like page_in(), adds
+   VADDR's page to the stack if VADDR looks like a stack access.
+   Returns true if successful, false if VADDR is not part of the
+   process's address space, if WRITE is true and the page is
+   read-only, or if memory allocation or disk read fails. */
+bool
+page_pin (const void *vaddr, bool write)
+{
+  struct page *p = page_lookup (vaddr);
+  bool success;
+
+  if (p == NULL)
+    p = grow_stack (vaddr);
+  if (p == NULL || (write && !p->writable))
+    return false;
+
+  lock_acquire (&p->lock);
+  success = fault_in (p, write);
+  if (success)
+    p->pinned = true;
+  lock_release (&p->lock);
+
+  return success;
+}
+
+/* Allows the page containing VADDR, which must have been pinned
+   with page_pin(), to be evicted again. */
+void
+page_unpin (const void *vaddr)
+{
+  struct page *p = page_lookup (vaddr);
+
+  ASSERT (p != NULL);
+
+  lock_acquire (&p->lock);
+  ASSERT (p->pinned);
+  p->pinned = false;
+  lock_release (&p->lock);
+}
+
+/* Prints supplemental page table statistics. */
+void
+page_print_stats (void)
+{
+  int i;
+
+  printf ("Page: %lld pages recorded, %lld file, %lld zero, %lld anon "
+          "and %lld swap brought in, %lld read ahead\n",
+          record_cnt, load_cnt[PAGE_FILE], load_cnt[PAGE_ZERO],
+          load_cnt[PAGE_ANON], load_cnt[PAGE_SWAP], readahead_cnt);
+  printf ("Page: %zu pages resident, peak %zu, %lld evicted "
+          "(%lld to swap), %lld freed while not resident\n",
+          resident_cnt, peak_resident_cnt, evict_cnt, swap_evict_cnt,
+          freed_out_cnt);
+  printf ("Page: %lld mapped file pages written back\n", write_back_cnt);
+  printf ("Page: %lld pages shared by fork, %lld copied on write, "
+          "%lld reclaimed without copying\n",
+          share_cnt, cow_copy_cnt, cow_reuse_cnt);
+  printf ("Page: %lld minor and %lld major faults, %lld cached pages "
+          "mapped around faults, %lld file pages read ahead\n",
+          minor_cnt, major_cnt, around_cnt, file_readahead_cnt);
+  printf ("Page: %lld stack pages added on demand, "
+          "%lld zero pages mapped to the zero frame\n",
+          stack_grow_cnt, zero_map_cnt);
+  printf ("Page: fault latency in cycles:");
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    {
+      unsigned long long bound = 1ULL << (LATENCY_SHIFT + i) >> 10;
+
+      if (i % 6 == 0 && i > 0)
+        printf ("\nPage:  ");
+      if (i < LATENCY_BUCKETS - 1)
+        printf (" <%lluK %lld", bound, latency_hist[i]);
+      else
+        printf (" >=%lluK %lld", bound >> 1, latency_hist[i]);
+    }
+  printf ("\n");
+}
+
+/* Adds a page of the given TYPE at UPAGE to the current
+   process's supplemental page table.  Returns the new page if
+   successful, a null pointer if UPAGE is already in use or on
+   memory allocation failure. */
+static struct page *
+record (void *upage, enum page_type type, bool writable,
+        struct file *file, off_t ofs, uint32_t read_bytes)
+{
+  enum intr_level old_level;
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = kmem_cache_alloc (&page_cache);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->pagedir = thread_current ()->pagedir;
+  p->type = type;
+  p->writable = writable;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->swap_slot = SWAP_NONE;
+  p->pinned = false;
+  p->ghost = 0;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->write_back = false;
+
+  if (hash_insert (&thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      kmem_cache_free (&page_cache, p);
+      return NULL;
+    }
+
+  old_level = intr_disable ();
+  record_cnt++;
+  intr_set_level (old_level);
+  return p;
+}
+
+/* If VADDR looks like an access to the current process's stack,
+   adds an anonymous page for it to the process's page table and
+   returns it.  Otherwise, or on memory allocation failure,
+   returns a null pointer.  The page gets a frame only when it is
+   brought in. */
+static struct page *
+grow_stack (const void *vaddr)
+{
+  const uint8_t *addr = vaddr;
+  const uint8_t *esp = thread_current ()->user_esp;
+  enum intr_level old_level;
+  struct page *p;
+
+  if (!is_user_vaddr (addr)
+      || (size_t) ((uint8_t *) PHYS_BASE - addr) > page_stack_limit
+      || addr + STACK_SLOP < esp)
+    return NULL;
+
+  p = record (pg_round_down (addr), PAGE_ANON, true, NULL, 0, 0);
+  if (p != NULL)
+    {
+      old_level = intr_disable ();
+      stack_grow_cnt++;
+      intr_set_level (old_level);
+    }
+  return p;
+}
+
+/* Brings P, whose lock must be held, into memory if it isn't
+   already, and if WRITE is true, makes sure that it is mapped
+   writable in a frame of its own.  Returns true if successful,
+   false on memory allocation or disk read failure. */
+static bool
+fault_in (struct page *p, bool write)
+{
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (!write || p->writable);
+
+  /* Reading a zero-filled page just maps the zero frame.
+     Otherwise, a newly loaded writable page always gets a frame
+     of its own. */
+  if (p->frame == NULL)
+    {
+      if (!write && (p->type == PAGE_ZERO || p->type == PAGE_ANON))
+        return map_zero (p);
+      if (!load_page (p))
+        return false;
+      if (p->type == PAGE_FILE)
+        fault_around (p);
+      return true;
+    }
+
+  /* A failed eviction can leave P in its frame but unmapped (see
+     page_out()).  P may have been modified, so mark it dirty. */
+  if (pagedir_get_page (p->pagedir, p->upage) == NULL)
+    {
+      struct frame *f = p->frame;
+
+      if (!pagedir_set_page (p->pagedir, p->upage, f->kpage,
+                             map_writable (p, f)))
+        return false;
+      pagedir_set_dirty (p->pagedir, p->upage, true);
+    }
+  return !write || make_private (p);
+}
+
+/* Obtains a frame for P, which must not be resident, fills it
+   with P's contents, and maps it into the current process.
+   Returns true if successful, false on memory allocation or disk
+   read failure.  P's lock must be held. */
+static bool
+load_page (struct page *p)
+{
+  bool shareable = is_shareable (p);
+  enum intr_level old_level;
+  struct frame *f;
+  bool minor = p->type == PAGE_ZERO || p->type == PAGE_ANON;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  for (;;)
+    {
+      /* Another process running the same program, or another
+         mapping of the same file, may have this page in memory
+         already. */
+      f = shareable ? frame_cache_lookup (p, true) : NULL;
+      if (f != NULL)
+        {
+          minor = true;
+          break;
+        }
+
+      f = frame_alloc (p);
+      if (f == NULL)
+        return false;
+      if (!read_page (p, f->kpage))
+        {
+          frame_release (f, p);
+          return false;
+        }
+      if (!shareable || frame_cache_insert (f, p) || !p->write_back)
+        break;
+
+      /* Another mapping read the same page in the meantime.
+         Mappings must not have copies of their own, so use its
+         frame instead. */
+      frame_release (f, p);
+    }
+
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, p->writable))
+    {
+      frame_release (f, p);
+      return false;
+    }
+  p->frame = f;
+
+  old_level = intr_disable ();
+  load_cnt[p->type]++;
+  if (minor)
+    minor_cnt++;
+  else
+    major_cnt++;
+  if (++resident_cnt > peak_resident_cnt)
+    peak_resident_cnt = resident_cnt;
+  intr_set_level (old_level);
+
+  if (p->type == PAGE_SWAP)
+    swap_readahead (p->swap_slot);
+  return true;
+}
+
+/* Maps P, a zero-filled page that is not resident, read-only to
+   the zero frame.  Returns true if successful, false on memory
+   allocation failure.  P's lock must be held. */
+static bool
+map_zero (struct page *p)
+{
+  enum intr_level old_level;
+  struct frame *f;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  f = frame_zero (p);
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, false))
+    {
+      frame_release (f, p);
+      return false;
+    }
+  p->frame = f;
+
+  old_level = intr_disable ();
+  zero_map_cnt++;
+  minor_cnt++;
+  if (++resident_cnt > peak_resident_cnt)
+    peak_resident_cnt = resident_cnt;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Called after P, a page of a file, has been brought in for a
+   fault.  Maps the pages in the block around P that are in the
+   page cache, adapts the readahead window, and reads ahead the
+   pages after P if the fault looks sequential.  P's lock must be
+   held. */
+static void
+fault_around (struct page *p)
+{
+  struct thread *t = thread_current ();
+  uint8_t *upage = p->upage;
+  uint8_t *block;
+  size_t i;
+
+  if (t->ra_next == upage)
+    {
+      t->ra_window *= 2;
+      if (t->ra_window < READAHEAD_MIN)
+        t->ra_window = READAHEAD_MIN;
+      else if (t->ra_window > READAHEAD_MAX)
+        t->ra_window = READAHEAD_MAX;
+    }
+  else
+    t->ra_window = 0;
+  t->ra_next = upage + (t->ra_window + 1) * PGSIZE;
+
+  block = (uint8_t *) ((uintptr_t) upage & ~(FAULT_AROUND * PGSIZE - 1));
+  for (i = 0; i < FAULT_AROUND; i++)
+    if (block + i * PGSIZE != upage)
+      bring_in_neighbor (block + i * PGSIZE, false);
+  for (i = 1; i <= t->ra_window; i++)
+    if (!bring_in_neighbor (upage + i * PGSIZE, true))
+      break;
+}
+
+/* If the current process's page at UPAGE is a page of a file
+   that is not resident, and its lock is free, maps it from the
+   page cache, or, if READ is true, reads it into a free frame.
+   Never waits for a lock or evicts a page.  Returns false if
+   there was no free frame, true otherwise. */
+static bool
+bring_in_neighbor (uint8_t *upage, bool read)
+{
+  enum intr_level old_level;
+  struct frame *f = NULL;
+  bool success = true;
+  bool cached = false;
+  struct page *q;
+
+  if (!is_user_vaddr (upage))
+    return true;
+  q = page_lookup (upage);
+  if (q == NULL || q->type != PAGE_FILE || !lock_try_acquire (&q->lock))
+    return true;
+  if (q->frame != NULL)
+    {
+      lock_release (&q->lock);
+      return true;
+    }
+
+  if (is_shareable (q))
+    f = frame_cache_lookup (q, false);
+  if (f != NULL)
+    cached = true;
+  else if (read)
+    {
+      f = frame_try_alloc (q);
+      if (f == NULL)
+        success = false;
+      else if (!read_page (q, f->kpage)
+               || (is_shareable (q) && !frame_cache_insert (f, q)
+                   && q->write_back))
+        {
+          frame_release (f, q);
+          f = NULL;
+        }
+    }
+
+  if (f != NULL)
+    {
+      if (pagedir_set_page (q->pagedir, q->upage, f->kpage, q->writable))
+        {
+          q->frame = f;
+
+          old_level = intr_disable ();
+          if (cached)
+            around_cnt++;
+          else
+            file_readahead_cnt++;
+          if (++resident_cnt > peak_resident_cnt)
+            peak_resident_cnt = resident_cnt;
+          intr_set_level (old_level);
+        }
+      else
+        {
+          frame_release (f, q);
+          success = false;
+        }
+    }
+  lock_release (&q->lock);
+  return success;
+}
+
+/* Fills KPAGE with the contents of P, which must not be
+   resident.  Returns true if successful, false on disk read
+   failure. */
+static bool
+read_page (struct page *p, uint8_t *kpage)
+{
+  if (p->type == PAGE_FILE)
+    {
+      off_t bytes_read;
+
+      lock_acquire (&filesys_lock);
+      bytes_read = file_read_at (p->file, kpage, p->read_bytes, p->file_ofs);
+      lock_release (&filesys_lock);
+      if (bytes_read != (off_t) p->read_bytes)
+        return false;
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+  else if (p->type == PAGE_SWAP)
+    swap_in (p->swap_slot, kpage);
+  else
+    memset (kpage, 0, PGSIZE);
+  return true;
+}
+
+/* Brings in those of the current process's pages that are in
+   the SWAP_READAHEAD swap slots after SLOT, as long as there are
+   free frames.  Pages that are busy are skipped. */
+static void
+swap_readahead (size_t slot)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  size_t i;
+
+  for (i = 1; i <= SWAP_READAHEAD; i++)
+    {
+      /* A page of our own can only be destroyed by us, so Q stays
+         valid even though we don't hold the swap lock. */
+      struct page *q = swap_owner (slot + i, pd);
+      enum intr_level old_level;
+      struct frame *f;
+
+      if (q == NULL || !lock_try_acquire (&q->lock))
+        continue;
+      if (q->frame != NULL || q->swap_slot != slot + i)
+        {
+          lock_release (&q->lock);
+          continue;
+        }
+
+      f = frame_try_alloc (q);
+      if (f == NULL)
+        {
+          lock_release (&q->lock);
+          break;
+        }
+      swap_in (q->swap_slot, f->kpage);
+      if (!pagedir_set_page (pd, q->upage, f->kpage, q->writable))
+        {
+          frame_release (f, q);
+          lock_release (&q->lock);
+          break;
+        }
+      q->frame = f;
+      lock_release (&q->lock);
+
+      old_level = intr_disable ();
+      readahead_cnt++;
+      if (++resident_cnt > peak_resident_cnt)
+        peak_resident_cnt = resident_cnt;
+      intr_set_level (old_level);
+    }
+}
+
+/* Shares the frame of resident page P, in the process being
+   forked, with C, a new page at the same address in the current
+   process, copy-on-write.  P's lock must be held.  Returns true
+   if successful, false on memory allocation failure. */
+static bool
+share_page (struct page *p, struct page *c)
+{
+  struct frame *f = p->frame;
+  enum intr_level old_level;
+
+  if (!pagedir_set_page (c->pagedir, c->upage, f->kpage, false))
+    return false;
+  if (p->writable)
+    pagedir_set_writable (p->pagedir, p->upage, false);
+  pagedir_set_dirty (c->pagedir, c->upage,
+                     pagedir_is_dirty (p->pagedir, p->upage));
+  frame_share (f, c);
+  c->frame = f;
+
+  old_level = intr_disable ();
+  share_cnt++;
+  if (++resident_cnt > peak_resident_cnt)
+    peak_resident_cnt = resident_cnt;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Maps P, a writable resident page whose lock must be held,
+   writable in a frame of its own.  If P's frame is shared, P
+   gets a copy, unless P is a page of a mapped file, whose frame
+   is meant to be shared.  Returns true if successful, false on
+   memory allocation failure. */
+static bool
+make_private (struct page *p)
+{
+  struct frame *f = p->frame;
+  struct frame *copy;
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (f != NULL && p->writable);
+
+  /* Pages are only added to F by a process holding the lock of
+     a page in F, so if P is F's only page, it stays that way.
+     P may still be mapped read-only from when F was shared.  A
+     page of a mapped file shares F with the other mappings by
+     design, so it is simply mapped writable too. */
+  if (map_writable (p, f))
+    {
+      if (pagedir_is_writable (p->pagedir, p->upage))
+        return true;
+      pagedir_set_writable (p->pagedir, p->upage, true);
+      old_level = intr_disable ();
+      cow_reuse_cnt++;
+      minor_cnt++;
+      intr_set_level (old_level);
+      return true;
+    }
+
+  copy = frame_copy (f, p);
+  if (copy == NULL)
+    return false;
+  p->frame = copy;
+
+  /* Switch the mapping over with interrupts off, so that the page
+     table can't be freed in between and this can't fail.  The
+     copy may differ from the file it came from, and nothing else
+     says so, so mark it dirty. */
+  old_level = intr_disable ();
+  pagedir_clear_page (p->pagedir, p->upage);
+  success = pagedir_set_page (p->pagedir, p->upage, copy->kpage, true);
+  intr_set_level (old_level);
+  ASSERT (success);
+  pagedir_set_dirty (p->pagedir, p->upage, true);
+
+  old_level = intr_disable ();
+  cow_copy_cnt++;
+  minor_cnt++;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns true if P's frame belongs in the page cache, shared
+   with every other page that holds the same data: P is either a
+   read-only page of an executable or a page of a mapped file. */
+static bool
+is_shareable (const struct page *p)
+{
+  return p->type == PAGE_FILE && (!p->writable || p->write_back);
+}
+
+/* Returns true if P, a page held in frame F, may be mapped
+   writable: P is writable and F is not shared copy-on-write. */
+static bool
+map_writable (const struct page *p, const struct frame *f)
+{
+  return p->writable && (f->ref_cnt == 1 || p->write_back);
+}
+
+/* Adds a fault that took CYCLES cycles to the latency
+   histogram. */
+static void
+note_latency (uint64_t cycles)
+{
+  enum intr_level old_level;
+  int bucket = 0;
+
+  for (cycles >>= LATENCY_SHIFT; cycles > 0 && bucket < LATENCY_BUCKETS - 1;
+       cycles >>= 1)
+    bucket++;
+
+  old_level = intr_disable ();
+  latency_hist[bucket]++;
+  intr_set_level (old_level);
+}
+
+/* Returns a hash value for the page that E refers to. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_int ((uintptr_t) p->upage >> PGBITS);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  const struct page *pa = hash_entry (a, struct page, hash_elem);
+  const struct page *pb = hash_entry (b, struct page, hash_elem);
+  return pa->upage < pb->upage;
+}
+
+/* Frees the page that E refers to, which prepare_discard() has
+   been called for and which has been unmapped since. */
+static void
+destroy_page (struct hash_elem *e, void *aux UNUSED)
+{
+  discard_page (hash_entry (e, struct page, hash_elem));
+}
+
+/* Readies P, a page of the current process, to be unmapped and
+   discarded: takes its lock, waiting out any eviction in
+   progress, and writes it back to its file if it is a modified
+   page of a memory-mapped file.  With the lock held, P stays as
+   it is until discard_page(). */
+static void
+prepare_discard (struct page *p)
+{
+  ASSERT (p != NULL);
+
+  lock_acquire (&p->lock);
+  if (p->frame != NULL && p->write_back
+      && pagedir_is_dirty (p->pagedir, p->upage))
+    write_back (p, p->frame->kpage);
+}
+
+/* Releases the frame and swap slot of P, which
+   prepare_discard() has been called for, which has been unmapped
+   since, and which must already have been removed from the
+   current process's page table, and frees P. */
+static void
+discard_page (struct page *p)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  old_level = intr_disable ();
+  if (p->frame != NULL)
+    resident_cnt--;
+  else
+    freed_out_cnt++;
+  intr_set_level (old_level);
+
+  if (p->frame != NULL)
+    {
+      frame_release (p->frame, p);
+      p->frame = NULL;
+    }
+  swap_free (p->swap_slot, p);
+  frame_forget (p);
+  lock_release (&p->lock);
+
+  kmem_cache_free (&page_cache, p);
+}
+
+/* Writes KPAGE, which holds P, a page of a memory-mapped file,
+   back to P's file. */
+static void
+write_back (struct page *p, const void *kpage)
+{
+  enum intr_level old_level;
+
+  lock_acquire (&filesys_lock);
+  file_write_at (p->file, kpage, p->read_bytes, p->file_ofs);
+  lock_release (&filesys_lock);
+
+  old_level = intr_disable ();
+  write_back_cnt++;
+  intr_set_level (old_level);
+}
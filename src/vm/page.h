@@ -0,0 +1,81 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct file;
+struct frame;
+struct thread;
+
+/* Where a virtual page's contents come from when it is first
+   brought into memory. */
+enum page_type
+  {
+    PAGE_FILE,                  /* Read from a file, zero the rest. */
+    PAGE_ZERO,                  /* All zeros, e.g. a segment's BSS. */
+    PAGE_ANON,                  /* Anonymous memory, e.g. the stack. */
+    PAGE_SWAP                   /* Read from swap. */
+  };
+
+/* A virtual page in a process's supplemental page table.
+
+   The hardware page table only says where a resident page is.
+   This records what belongs at each user virtual page, resident
+   or not, so that the page fault handler can bring it in. */
+struct page
+  {
+    struct hash_elem hash_elem; /* Element in thread's page table. */
+    void *upage;                /* User virtual address. */
+    uint32_t *pagedir;          /* Owning process's page directory. */
+    enum page_type type;        /* Source of the page's contents. */
+    bool writable;              /* Writable by the user process? */
+
+    /* The owning process only changes the members below with
+       LOCK held.  Other processes may take LOCK to evict the
+       page. */
+    struct lock lock;           /* Protects the page's residency. */
+    struct frame *frame;        /* Frame holding the page, or null. */
+    struct list_elem frame_elem; /* Element in FRAME's list of pages. */
+    size_t swap_slot;           /* Swap slot with a copy, or SWAP_NONE. */
+    bool pinned;                /* In use by the kernel, don't evict. */
+
+    /* Owned by the replacement policy in vm/policy.c, under the
+       frame table's lock. */
+    struct list_elem ghost_elem; /* Element in a list of evicted pages. */
+    int ghost;                  /* List holding this page, or 0. */
+
+    /* PAGE_FILE only. */
+    struct file *file;          /* File to read. */
+    off_t file_ofs;             /* Offset in FILE. */
+    uint32_t read_bytes;        /* Bytes to read; the rest are zeroed. */
+    bool write_back;            /* Write changes back to FILE? */
+  };
+
+/* Maximum size of a user stack, in bytes. */
+extern size_t page_stack_limit;
+
+void page_init (void);
+bool page_table_init (void);
+bool page_table_copy (struct thread *parent);
+void page_table_destroy (void);
+
+bool page_record_file (void *upage, struct file *, off_t ofs,
+                       uint32_t read_bytes, bool writable);
+bool page_record_zero (void *upage, bool writable);
+bool page_record_anon (void *upage, bool writable);
+bool page_record_mmap (void *upage, struct file *, off_t ofs,
+                       uint32_t read_bytes);
+void page_remove_range (void *upage, size_t page_cnt);
+struct page *page_lookup (const void *vaddr);
+bool page_in (const void *vaddr, bool write);
+bool page_out (struct frame *);
+bool page_pin (const void *vaddr, bool write);
+void page_unpin (const void *vaddr);
+
+void page_print_stats (void);
+
+#endif /* vm/page.h */
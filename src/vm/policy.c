@@ -0,0 +1,615 @@
+#include "vm/policy.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Page replacement policies.
+
+   All the frame table can learn about how a page is used is
+   whether its accessed bit has been set since it last looked,
+   so each policy here is built on the "clock" algorithm, which
+   works from accessed bits instead of an exact order of use.
+
+   "clock" keeps every frame on one circular queue.  A hand
+   sweeps around it, clearing accessed bits, and evicts the first
+   frame it finds whose bit is already clear.  It is cheap, but a
+   big sequential scan flushes out everything else, because each
+   page of the scan looks just as recently used as the pages that
+   really are in use.
+
+   "2q" is the 2Q algorithm of Johnson and Shasha.  A frame
+   brought in on a fault joins a FIFO queue, A1in, of about a
+   quarter of memory, and leaves it in order whether or not it
+   has been used meanwhile.  Its page is then remembered on A1out,
+   a list of "ghost" pages with no frames, of up to half as many
+   pages as memory.  A page faulted in again while it is still
+   remembered there has been used more than once, so its frame
+   joins the main queue, Am, which is swept like a clock.  A scan
+   passes through A1in without disturbing Am.
+
+   "arc" is CAR, the clock form of Megiddo and Modha's Adaptive
+   Replacement Cache, by Bansal and Modha.  New frames join the
+   clock T1, and a frame in T1 whose accessed bit is set when the
+   hand reaches it moves to the clock T2, so T1 holds pages used
+   once lately and T2 pages used more than once.  Ghost lists B1
+   and B2 remember the pages evicted from each.  A fault on a
+   page in B1 means T1 was too small, and one in B2 that T2 was,
+   so each moves the target size of T1 toward the other, and the
+   split between recency and frequency adapts to the workload.
+
+   The fault that brings a page in sets its accessed bit, too,
+   so CAR counts a new frame in T1 as used only if it has been
+   accessed again after the hand first passed over it.
+
+   A frame shared by several pages is remembered through its
+   first page only.
+
+   Every queue is a list whose front is under the clock hand.
+   Passing over a frame moves it to the back. */
+
+/* Number of frames nearest the hand that choose_dirty() looks
+   at in each queue.  Every frame of an eviction cluster but the
+   first calls it, so it must not scan whole queues. */
+#define DIRTY_WINDOW 16
+
+/* Frame queues.  The numbers are kept in the frames' "queue"
+   members. */
+enum queue_id
+  {
+    Q_CLOCK,                    /* Clock: all frames. */
+    Q_A1IN,                     /* 2Q: frames on probation. */
+    Q_AM,                       /* 2Q: frames used more than once. */
+    Q_T1,                       /* CAR: frames used once lately. */
+    Q_T2,                       /* CAR: frames used more than once. */
+    Q_CNT
+  };
+
+/* Ghost lists.  The numbers are kept in the pages' "ghost"
+   members. */
+enum ghost_id
+  {
+    GHOST_NONE,                 /* Not remembered. */
+    GHOST_A1OUT,                /* 2Q: evicted from A1in. */
+    GHOST_B1,                   /* CAR: evicted from T1. */
+    GHOST_B2                    /* CAR: evicted from T2. */
+  };
+
+/* A queue of frames. */
+struct queue
+  {
+    struct list frames;         /* Frames, front under the hand. */
+    size_t cnt;                 /* Number of frames. */
+  };
+
+/* A list of evicted pages, oldest first. */
+struct ghost_list
+  {
+    struct list pages;          /* Pages. */
+    size_t cnt;                 /* Number of pages. */
+    enum ghost_id id;           /* Identifies this list. */
+  };
+
+/* Frame queues. */
+static struct queue queues[Q_CNT];
+
+/* Ghost lists. */
+static struct ghost_list a1out, b1, b2;
+
+/* CAR: frames in the user pool. */
+static size_t capacity;
+
+/* 2Q: most frames in A1in and most pages in A1out. */
+static size_t a1in_max, a1out_max;
+
+/* CAR: target number of frames in T1. */
+static size_t t1_target;
+
+/* Statistics. */
+static long long examine_cnt;           /* Frames looked at by hands. */
+static long long ghost_hit_cnt[4];      /* Faults on remembered pages. */
+
+static void queue_push (enum queue_id, struct frame *);
+static struct frame *sweep (enum queue_id, enum queue_id hot_id);
+static struct frame *find_dirty (enum queue_id);
+static void ghost_init (struct ghost_list *, enum ghost_id);
+static void ghost_push (struct ghost_list *, struct frame *);
+static void ghost_remove (struct ghost_list *, struct page *);
+static void ghost_trim (struct ghost_list *, size_t max_cnt);
+static struct page *first_page (struct frame *);
+static void generic_remove (struct frame *);
+
+static void clock_init (size_t);
+static void clock_add (struct frame *, struct page *);
+static struct frame *clock_choose (void);
+static struct frame *clock_choose_dirty (void);
+static void clock_forget (struct page *);
+static void clock_print_stats (void);
+
+static void twoq_init (size_t);
+static void twoq_add (struct frame *, struct page *);
+static struct frame *twoq_choose (void);
+static struct frame *twoq_choose_dirty (void);
+static void twoq_forget (struct page *);
+static void twoq_print_stats (void);
+
+static void arc_init (size_t);
+static void arc_add (struct frame *, struct page *);
+static struct frame *arc_choose (void);
+static struct frame *arc_choose_dirty (void);
+static void arc_forget (struct page *);
+static void arc_print_stats (void);
+
+static const struct frame_policy clock_policy =
+  {
+    "clock", clock_init, clock_add, generic_remove,
+    clock_choose, clock_choose_dirty, clock_forget, clock_print_stats,
+  };
+
+static const struct frame_policy twoq_policy =
+  {
+    "2q", twoq_init, twoq_add, generic_remove,
+    twoq_choose, twoq_choose_dirty, twoq_forget, twoq_print_stats,
+  };
+
+static const struct frame_policy arc_policy =
+  {
+    "arc", arc_init, arc_add, generic_remove,
+    arc_choose, arc_choose_dirty, arc_forget, arc_print_stats,
+  };
+
+/* All the policies.  The first is the default. */
+static const struct frame_policy *const policies[] =
+  {
+    &clock_policy, &twoq_policy, &arc_policy,
+  };
+#define POLICY_CNT (sizeof policies / sizeof *policies)
+
+/* The policy in use. */
+const struct frame_policy *frame_policy = &clock_policy;
+
+/* Returns the policy named NAME, or a null pointer if there is
+   none. */
+const struct frame_policy *
+policy_lookup (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < POLICY_CNT; i++)
+    if (!strcmp (policies[i]->name, name))
+      return policies[i];
+  return NULL;
+}
+
+/* Clock. */
+
+/* Prepares the clock policy.  The other policies start out the
+   same way. */
+static void
+clock_init (size_t frame_cnt UNUSED)
+{
+  size_t i;
+
+  for (i = 0; i < Q_CNT; i++)
+    {
+      list_init (&queues[i].frames);
+      queues[i].cnt = 0;
+    }
+}
+
+/* Adds F just behind the hand, where the hand will reach it
+   last. */
+static void
+clock_add (struct frame *f, struct page *page UNUSED)
+{
+  f->fresh = false;
+  queue_push (Q_CLOCK, f);
+}
+
+/* Sweeps the hand until it finds a frame to evict. */
+static struct frame *
+clock_choose (void)
+{
+  size_t i;
+
+  /* Two trips around are enough to find a frame whose accessed
+     bit was cleared on the first. */
+  for (i = 0; i < 2 * queues[Q_CLOCK].cnt; i++)
+    {
+      struct frame *f = sweep (Q_CLOCK, Q_CLOCK);
+      if (f != NULL)
+        return f;
+    }
+  return NULL;
+}
+
+/* Finds a modified frame ahead of the hand. */
+static struct frame *
+clock_choose_dirty (void)
+{
+  return find_dirty (Q_CLOCK);
+}
+
+/* The clock policy remembers no pages. */
+static void
+clock_forget (struct page *page UNUSED)
+{
+  NOT_REACHED ();
+}
+
+/* Prints clock statistics. */
+static void
+clock_print_stats (void)
+{
+  printf ("Frame: clock policy: %lld frames examined\n", examine_cnt);
+}
+
+/* 2Q. */
+
+/* Prepares the 2Q policy for FRAME_CNT frames. */
+static void
+twoq_init (size_t frame_cnt)
+{
+  clock_init (frame_cnt);
+  ghost_init (&a1out, GHOST_A1OUT);
+  a1in_max = frame_cnt / 4 > 0 ? frame_cnt / 4 : 1;
+  a1out_max = frame_cnt / 2;
+}
+
+/* Adds F to Am if PAGE was recently evicted from A1in, otherwise
+   to A1in. */
+static void
+twoq_add (struct frame *f, struct page *page)
+{
+  f->fresh = false;
+  if (page == NULL)
+    {
+      twoq_forget (first_page (f));
+      queue_push (f->queue, f);
+    }
+  else if (page->ghost == GHOST_A1OUT)
+    {
+      ghost_remove (&a1out, page);
+      ghost_hit_cnt[GHOST_A1OUT]++;
+      queue_push (Q_AM, f);
+    }
+  else
+    queue_push (Q_A1IN, f);
+}
+
+/* Evicts the oldest frame in A1in if A1in is over its share,
+   otherwise sweeps Am. */
+static struct frame *
+twoq_choose (void)
+{
+  struct queue *a1in = &queues[Q_A1IN];
+  struct queue *am = &queues[Q_AM];
+  size_t i;
+
+  for (i = 0; i < 2 * (a1in->cnt + am->cnt); i++)
+    {
+      struct frame *f;
+
+      if (a1in->cnt > a1in_max || (a1in->cnt > 0 && am->cnt == 0))
+        {
+          f = list_entry (list_pop_front (&a1in->frames), struct frame, elem);
+          list_push_back (&a1in->frames, &f->elem);
+          examine_cnt++;
+          if (!frame_lock_pages (f))
+            continue;
+          ghost_push (&a1out, f);
+          ghost_trim (&a1out, a1out_max);
+          return f;
+        }
+
+      f = sweep (Q_AM, Q_AM);
+      if (f != NULL)
+        return f;
+    }
+  return NULL;
+}
+
+/* Finds a modified frame in A1in, or failing that in Am. */
+static struct frame *
+twoq_choose_dirty (void)
+{
+  struct frame *f = find_dirty (Q_A1IN);
+  if (f != NULL)
+    {
+      ghost_push (&a1out, f);
+      ghost_trim (&a1out, a1out_max);
+      return f;
+    }
+  return find_dirty (Q_AM);
+}
+
+/* Removes PAGE from A1out. */
+static void
+twoq_forget (struct page *page)
+{
+  if (page->ghost == GHOST_A1OUT)
+    ghost_remove (&a1out, page);
+}
+
+/* Prints 2Q statistics. */
+static void
+twoq_print_stats (void)
+{
+  printf ("Frame: 2q policy: %zu frames in A1in (max %zu), %zu in Am, "
+          "%zu pages in A1out (max %zu)\n",
+          queues[Q_A1IN].cnt, a1in_max, queues[Q_AM].cnt, a1out.cnt,
+          a1out_max);
+  printf ("Frame: 2q policy: %lld frames promoted to Am, "
+          "%lld frames examined\n",
+          ghost_hit_cnt[GHOST_A1OUT], examine_cnt);
+}
+
+/* CAR. */
+
+/* Prepares the CAR policy for FRAME_CNT frames. */
+static void
+arc_init (size_t frame_cnt)
+{
+  clock_init (frame_cnt);
+  ghost_init (&b1, GHOST_B1);
+  ghost_init (&b2, GHOST_B2);
+  capacity = frame_cnt;
+  t1_target = 0;
+}
+
+/* Adds F to T2 if PAGE was recently evicted, adapting T1's
+   target to the list it was found on, otherwise to T1. */
+static void
+arc_add (struct frame *f, struct page *page)
+{
+  size_t t1_cnt = queues[Q_T1].cnt;
+  size_t t2_cnt = queues[Q_T2].cnt;
+
+  f->fresh = false;
+  if (page == NULL)
+    {
+      arc_forget (first_page (f));
+      queue_push (f->queue, f);
+    }
+  else if (page->ghost == GHOST_B1)
+    {
+      size_t delta = b1.cnt >= b2.cnt ? 1 : b2.cnt / b1.cnt;
+
+      t1_target = t1_target + delta < capacity ? t1_target + delta : capacity;
+      ghost_remove (&b1, page);
+      ghost_hit_cnt[GHOST_B1]++;
+      queue_push (Q_T2, f);
+    }
+  else if (page->ghost == GHOST_B2)
+    {
+      size_t delta = b2.cnt >= b1.cnt ? 1 : b1.cnt / b2.cnt;
+
+      t1_target = t1_target > delta ? t1_target - delta : 0;
+      ghost_remove (&b2, page);
+      ghost_hit_cnt[GHOST_B2]++;
+      queue_push (Q_T2, f);
+    }
+  else
+    {
+      /* Keep T1 and B1 to the size of memory, and everything to
+         twice that. */
+      if (t1_cnt + b1.cnt >= capacity && b1.cnt > 0)
+        ghost_trim (&b1, b1.cnt - 1);
+      else if (t1_cnt + t2_cnt + b1.cnt + b2.cnt >= 2 * capacity
+               && b2.cnt > 0)
+        ghost_trim (&b2, b2.cnt - 1);
+      f->fresh = true;
+      queue_push (Q_T1, f);
+    }
+}
+
+/* Sweeps T1 if it is at least its target size, otherwise T2,
+   until a frame to evict turns up. */
+static struct frame *
+arc_choose (void)
+{
+  struct queue *t1 = &queues[Q_T1];
+  struct queue *t2 = &queues[Q_T2];
+  size_t i;
+
+  /* A fresh frame may take a third trip. */
+  for (i = 0; i < 3 * (t1->cnt + t2->cnt); i++)
+    {
+      struct frame *f;
+
+      if (t1->cnt > 0 && (t1->cnt >= t1_target || t2->cnt == 0))
+        {
+          f = sweep (Q_T1, Q_T2);
+          if (f != NULL)
+            {
+              ghost_push (&b1, f);
+              ghost_trim (&b1, capacity);
+              return f;
+            }
+        }
+      else
+        {
+          f = sweep (Q_T2, Q_T2);
+          if (f != NULL)
+            {
+              ghost_push (&b2, f);
+              ghost_trim (&b2, capacity);
+              return f;
+            }
+        }
+    }
+  return NULL;
+}
+
+/* Finds a modified frame in T1, or failing that in T2. */
+static struct frame *
+arc_choose_dirty (void)
+{
+  struct frame *f;
+
+  f = find_dirty (Q_T1);
+  if (f != NULL)
+    {
+      ghost_push (&b1, f);
+      ghost_trim (&b1, capacity);
+      return f;
+    }
+  f = find_dirty (Q_T2);
+  if (f != NULL)
+    {
+      ghost_push (&b2, f);
+      ghost_trim (&b2, capacity);
+    }
+  return f;
+}
+
+/* Removes PAGE from B1 or B2. */
+static void
+arc_forget (struct page *page)
+{
+  if (page->ghost == GHOST_B1)
+    ghost_remove (&b1, page);
+  else if (page->ghost == GHOST_B2)
+    ghost_remove (&b2, page);
+}
+
+/* Prints CAR statistics. */
+static void
+arc_print_stats (void)
+{
+  printf ("Frame: arc policy: %zu frames in T1 (target %zu), %zu in T2, "
+          "%zu pages in B1, %zu in B2\n",
+          queues[Q_T1].cnt, t1_target, queues[Q_T2].cnt, b1.cnt, b2.cnt);
+  printf ("Frame: arc policy: %lld faults on B1 pages, %lld on B2 pages, "
+          "%lld frames examined\n",
+          ghost_hit_cnt[GHOST_B1], ghost_hit_cnt[GHOST_B2], examine_cnt);
+}
+
+/* Helpers. */
+
+/* Adds F to the back of queue ID. */
+static void
+queue_push (enum queue_id id, struct frame *f)
+{
+  list_push_back (&queues[id].frames, &f->elem);
+  queues[id].cnt++;
+  f->queue = id;
+}
+
+/* Removes F from its queue. */
+static void
+generic_remove (struct frame *f)
+{
+  list_remove (&f->elem);
+  queues[f->queue].cnt--;
+}
+
+/* Passes the hand of queue ID, which must not be empty, over the
+   frame at its front.  If the frame has been accessed, clears
+   its accessed bits and moves it to the back of queue HOT_ID,
+   or of queue ID if it is fresh, otherwise to the back of queue
+   ID.  Returns the frame, with
+   its pages locked, if it has not been accessed and its pages
+   can be locked, otherwise a null pointer. */
+static struct frame *
+sweep (enum queue_id id, enum queue_id hot_id)
+{
+  struct frame *f = list_entry (list_front (&queues[id].frames),
+                                struct frame, elem);
+
+  examine_cnt++;
+  generic_remove (f);
+  if (!frame_lock_pages (f))
+    {
+      queue_push (id, f);
+      return NULL;
+    }
+  if (frame_is_accessed (f))
+    {
+      frame_clear_accessed (f);
+      frame_unlock_pages (f);
+      queue_push (f->fresh ? id : hot_id, f);
+      f->fresh = false;
+      return NULL;
+    }
+  f->fresh = false;
+  queue_push (id, f);
+  return f;
+}
+
+/* Returns the frame nearest the front of queue ID that has been
+   modified but not accessed lately, with its pages locked, or a
+   null pointer if there is none among the first DIRTY_WINDOW
+   frames.  Accessed bits are left alone and no frame is
+   moved. */
+static struct frame *
+find_dirty (enum queue_id id)
+{
+  struct list *frames = &queues[id].frames;
+  struct list_elem *e;
+  size_t i;
+
+  for (e = list_begin (frames), i = 0;
+       e != list_end (frames) && i < DIRTY_WINDOW; e = list_next (e), i++)
+    {
+      struct frame *f = list_entry (e, struct frame, elem);
+
+      examine_cnt++;
+      if (frame_is_dirty (f) && !frame_is_accessed (f)
+          && frame_lock_pages (f))
+        return f;
+    }
+  return NULL;
+}
+
+/* Initializes G as ghost list ID. */
+static void
+ghost_init (struct ghost_list *g, enum ghost_id id)
+{
+  list_init (&g->pages);
+  g->cnt = 0;
+  g->id = id;
+}
+
+/* Remembers F, which is about to be evicted, at the back of G. */
+static void
+ghost_push (struct ghost_list *g, struct frame *f)
+{
+  struct page *page = first_page (f);
+
+  ASSERT (page->ghost == GHOST_NONE);
+
+  list_push_back (&g->pages, &page->ghost_elem);
+  page->ghost = g->id;
+  g->cnt++;
+}
+
+/* Forgets PAGE, which must be in G. */
+static void
+ghost_remove (struct ghost_list *g, struct page *page)
+{
+  ASSERT (page->ghost == (int) g->id);
+
+  list_remove (&page->ghost_elem);
+  page->ghost = GHOST_NONE;
+  g->cnt--;
+}
+
+/* Forgets the oldest pages in G until at most MAX_CNT are
+   left. */
+static void
+ghost_trim (struct ghost_list *g, size_t max_cnt)
+{
+  while (g->cnt > max_cnt)
+    ghost_remove (g, list_entry (list_front (&g->pages),
+                                 struct page, ghost_elem));
+}
+
+/* Returns the first page held in F. */
+static struct page *
+first_page (struct frame *f)
+{
+  return list_entry (list_front (&f->pages), struct page, frame_elem);
+}
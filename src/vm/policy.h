@@ -0,0 +1,67 @@
+#ifndef VM_POLICY_H
+#define VM_POLICY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct frame;
+struct page;
+
+/* A page replacement policy, which decides which frame the frame
+   table evicts next.
+
+   A policy keeps every frame in the frame table on lists of its
+   own, through the frames' "elem" and "queue" members, and it
+   may remember pages it has recently evicted through the pages'
+   "ghost_elem" and "ghost" members.  All of its functions are
+   called with the frame table's lock held. */
+struct frame_policy
+  {
+    const char *name;           /* Name for -vm-policy. */
+
+    /* Prepares the policy for a user pool of FRAME_CNT frames. */
+    void (*init) (size_t frame_cnt);
+
+    /* Adds F, just brought in for PAGE, to the policy's lists.
+       PAGE is null if F is being put back after a failed
+       eviction. */
+    void (*add) (struct frame *f, struct page *page);
+
+    /* Removes F, which is leaving the frame table, from the
+       policy's lists. */
+    void (*remove) (struct frame *f);
+
+    /* Chooses a frame to evict and returns it with its pages
+       locked, or returns a null pointer if no frame can be
+       evicted.  The frame stays on the policy's lists until
+       remove() is called for it. */
+    struct frame *(*choose) (void);
+
+    /* Like choose(), but only returns a modified frame that has
+       not been accessed lately, to go to swap along with one that
+       choose() returned, or a null pointer if there is none
+       nearby. */
+    struct frame *(*choose_dirty) (void);
+
+    /* Forgets PAGE, which the policy remembers as evicted,
+       because PAGE is being freed or is resident again. */
+    void (*forget) (struct page *page);
+
+    /* Prints the policy's statistics. */
+    void (*print_stats) (void);
+  };
+
+/* The policy in use.  Set with the -vm-policy kernel command
+   line option. */
+extern const struct frame_policy *frame_policy;
+
+const struct frame_policy *policy_lookup (const char *name);
+
+/* Frame table functions for use by policies. */
+bool frame_lock_pages (struct frame *);
+void frame_unlock_pages (struct frame *);
+bool frame_is_accessed (struct frame *);
+void frame_clear_accessed (struct frame *);
+bool frame_is_dirty (struct frame *);
+
+#endif /* vm/policy.h */
@@ -0,0 +1,331 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <lzf.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Swap space.
+
+   The swap device is divided into page-sized slots of
+   SECTORS_PER_SLOT sectors each.  Slots are handed out "next
+   fit", continuing from just past the last slot allocated, so
+   that pages evicted together end up next to each other on disk.
+   That is all the clustering there is on the way out: each
+   swap_out() call writes one page, a sector at a time, as the
+   block layer has no multi-sector writes, so a cluster reaches
+   the disk as a run of writes to ascending sectors rather than
+   as one request.  It also makes it likely that pages next to
+   each other in swap were evicted together, which is what
+   swap-in readahead counts on.
+
+   Each slot in use records the page whose contents it holds and
+   the page directory of that page's process, so that readahead
+   can find the pages that a slot's neighbours belong to.
+
+   After fork(), parent and child share their swapped-out pages'
+   slots, so each slot also counts the pages that refer to it.
+   The slot is freed when the last of them lets it go.  Only the
+   page that wrote the slot is recorded as its owner, and only
+   until that page lets go of it.
+
+   In front of the device there may be a cache of compressed
+   pages, up to swap_cache_limit bytes of them.  A page written
+   to swap is compressed with LZF, and if it shrinks to no more
+   than CACHE_THRESHOLD bytes and fits in the cache, it is kept
+   there instead of being written, and reading it back is just a
+   matter of decompressing it.  Its slot is still allocated on
+   the device, so the cache adds no swap space, but a page that
+   doesn't compress or doesn't fit simply goes to disk as before.
+   Evicted pages are often mostly zeros, or text, which compress
+   well. */
+
+/* Sectors per slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Largest compressed page kept in the cache, in bytes. */
+#define CACHE_THRESHOLD (PGSIZE * 3 / 4)
+
+/* Owner of a slot. */
+struct slot
+  {
+    struct page *page;          /* Page whose contents are here. */
+    uint32_t *pagedir;          /* PAGE's process's page directory. */
+    unsigned ref_cnt;           /* Number of pages referring to slot. */
+    uint8_t *data;              /* Compressed contents, or null. */
+    size_t data_size;           /* Bytes in DATA. */
+  };
+
+/* Most bytes of compressed pages to cache.  Set with the
+   -swap-cache kernel command line option. */
+size_t swap_cache_limit;
+
+/* Swap device, or null if there is none. */
+static struct block *swap_device;
+
+/* Protects the members below. */
+static struct lock swap_lock;
+static struct bitmap *used_map;         /* Slots in use. */
+static struct slot *slots;              /* Owner of each slot. */
+static size_t next_slot;                /* Where to look for a free slot. */
+static size_t cache_bytes;              /* Bytes of compressed pages. */
+
+/* Serializes compression, which uses WORK. */
+static struct lock compress_lock;
+static uint8_t work[LZF_WORK_SIZE];
+
+/* Statistics. */
+static size_t slot_cnt;                 /* Slots on the device. */
+static size_t used_cnt;                 /* Slots in use. */
+static size_t peak_used_cnt;            /* Maximum of used_cnt. */
+static long long write_cnt;             /* Pages written. */
+static long long read_cnt;              /* Pages read. */
+static long long full_cnt;              /* Writes that found no slot. */
+static long long dup_cnt;               /* Extra references to slots. */
+static size_t cache_cnt;                /* Pages in cache. */
+static long long store_cnt;             /* Pages put in cache. */
+static long long store_bytes;           /* ...and their compressed size. */
+static long long reject_cnt;            /* Pages that didn't compress. */
+static long long overflow_cnt;          /* Pages that didn't fit. */
+static long long hit_cnt;               /* Pages read from cache. */
+
+static uint8_t *compress (const void *kpage, size_t *size);
+
+/* Initializes swap space.  If there is no swap device, all
+   attempts to swap out fail. */
+void
+swap_init (void)
+{
+  lock_init (&swap_lock);
+  lock_init (&compress_lock);
+
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  slot_cnt = block_size (swap_device) / SECTORS_PER_SLOT;
+  used_map = bitmap_create (slot_cnt);
+  slots = calloc (slot_cnt, sizeof *slots);
+  if (used_map == NULL || slots == NULL)
+    PANIC ("swap: not enough memory for %zu slots", slot_cnt);
+}
+
+/* Writes the page at KPAGE, which holds PAGE, to a newly
+   allocated slot, with PAGE as its only reference, or keeps it
+   in the cache.  Returns the slot, or SWAP_NONE if swap space is
+   full. */
+size_t
+swap_out (const void *kpage, struct page *page)
+{
+  size_t slot = BITMAP_ERROR;
+  uint8_t *data = NULL;
+  size_t data_size = 0;
+  bool cached = false;
+  size_t i;
+
+  if (swap_cache_limit > 0 && swap_device != NULL)
+    data = compress (kpage, &data_size);
+
+  lock_acquire (&swap_lock);
+  if (swap_device != NULL)
+    {
+      slot = bitmap_scan_and_flip (used_map, next_slot, 1, false);
+      if (slot == BITMAP_ERROR && next_slot != 0)
+        slot = bitmap_scan_and_flip (used_map, 0, 1, false);
+    }
+  if (slot == BITMAP_ERROR)
+    {
+      full_cnt++;
+      lock_release (&swap_lock);
+      free (data);
+      return SWAP_NONE;
+    }
+  slots[slot].page = page;
+  slots[slot].pagedir = page->pagedir;
+  slots[slot].ref_cnt = 1;
+  slots[slot].data = NULL;
+  next_slot = slot + 1;
+  if (++used_cnt > peak_used_cnt)
+    peak_used_cnt = used_cnt;
+  if (data != NULL && cache_bytes + data_size > swap_cache_limit)
+    overflow_cnt++;
+  else if (data != NULL)
+    {
+      slots[slot].data = data;
+      slots[slot].data_size = data_size;
+      cache_bytes += data_size;
+      cache_cnt++;
+      store_cnt++;
+      store_bytes += data_size;
+      cached = true;
+    }
+  if (!cached)
+    write_cnt++;
+  lock_release (&swap_lock);
+
+  if (cached)
+    return slot;
+  free (data);
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_write (swap_device, slot * SECTORS_PER_SLOT + i,
+                 (const uint8_t *) kpage + i * BLOCK_SECTOR_SIZE);
+  return slot;
+}
+
+/* Reads SLOT, which must be in use, into KPAGE.  The slot stays
+   in use. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  const uint8_t *data;
+  size_t data_size;
+  size_t i;
+
+  lock_acquire (&swap_lock);
+  ASSERT (slot < slot_cnt);
+  ASSERT (bitmap_test (used_map, slot));
+  data = slots[slot].data;
+  data_size = slots[slot].data_size;
+  if (data != NULL)
+    hit_cnt++;
+  else
+    read_cnt++;
+  lock_release (&swap_lock);
+
+  /* The caller's reference keeps the slot, and DATA, from being
+     freed in the meantime. */
+  if (data != NULL)
+    {
+      if (lzf_decompress (data, data_size, kpage, PGSIZE) != PGSIZE)
+        PANIC ("swap: slot %zu is corrupt in cache", slot);
+      return;
+    }
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_read (swap_device, slot * SECTORS_PER_SLOT + i,
+                (uint8_t *) kpage + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Adds a reference to SLOT, which must be in use, for another
+   page with the same contents.  If SLOT is SWAP_NONE, does
+   nothing. */
+void
+swap_dup (size_t slot)
+{
+  if (slot == SWAP_NONE)
+    return;
+
+  lock_acquire (&swap_lock);
+  ASSERT (slot < slot_cnt);
+  ASSERT (bitmap_test (used_map, slot));
+  slots[slot].ref_cnt++;
+  dup_cnt++;
+  lock_release (&swap_lock);
+}
+
+/* Drops PAGE's reference to SLOT, making SLOT available for
+   reuse if it was the last one.  If SLOT is SWAP_NONE, does
+   nothing. */
+void
+swap_free (size_t slot, const struct page *page)
+{
+  uint8_t *data = NULL;
+
+  if (slot == SWAP_NONE)
+    return;
+
+  lock_acquire (&swap_lock);
+  ASSERT (slot < slot_cnt);
+  ASSERT (bitmap_test (used_map, slot));
+  if (slots[slot].page == page)
+    {
+      slots[slot].page = NULL;
+      slots[slot].pagedir = NULL;
+    }
+  if (--slots[slot].ref_cnt == 0)
+    {
+      bitmap_reset (used_map, slot);
+      used_cnt--;
+      data = slots[slot].data;
+      if (data != NULL)
+        {
+          cache_bytes -= slots[slot].data_size;
+          cache_cnt--;
+        }
+    }
+  lock_release (&swap_lock);
+
+  free (data);
+}
+
+/* Returns the page whose contents are in SLOT, if SLOT is in use
+   by a page in the process with page directory PAGEDIR, or a
+   null pointer otherwise. */
+struct page *
+swap_owner (size_t slot, uint32_t *pagedir)
+{
+  struct page *page = NULL;
+
+  lock_acquire (&swap_lock);
+  if (slot < slot_cnt && bitmap_test (used_map, slot)
+      && slots[slot].page != NULL && slots[slot].pagedir == pagedir)
+    page = slots[slot].page;
+  lock_release (&swap_lock);
+
+  return page;
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %zu of %zu slots in use (peak %zu), "
+          "%lld pages written, %lld read, %lld times full, "
+          "%lld shared\n",
+          used_cnt, slot_cnt, peak_used_cnt, write_cnt, read_cnt, full_cnt,
+          dup_cnt);
+  if (swap_cache_limit == 0)
+    return;
+  printf ("Swap: cache holds %zu pages in %zu of %zu bytes, "
+          "%lld pages stored (%lld%% of original size), "
+          "%lld didn't compress, %lld didn't fit\n",
+          cache_cnt, cache_bytes, swap_cache_limit, store_cnt,
+          store_cnt > 0 ? store_bytes * 100 / (store_cnt * PGSIZE) : 0,
+          reject_cnt, overflow_cnt);
+  printf ("Swap: cache served %lld of %lld reads (%lld%%), "
+          "%lld sectors of disk I/O avoided\n",
+          hit_cnt, hit_cnt + read_cnt,
+          hit_cnt + read_cnt > 0 ? hit_cnt * 100 / (hit_cnt + read_cnt) : 0,
+          (store_cnt + hit_cnt) * SECTORS_PER_SLOT);
+}
+
+/* Compresses the page at KPAGE into a newly allocated block,
+   stores its size in *SIZE, and returns it.  Returns a null
+   pointer if the page does not compress to CACHE_THRESHOLD bytes
+   or less, or if memory is short. */
+static uint8_t *
+compress (const void *kpage, size_t *size)
+{
+  uint8_t *data = malloc (CACHE_THRESHOLD);
+  uint8_t *shrunk;
+
+  if (data == NULL)
+    return NULL;
+
+  lock_acquire (&compress_lock);
+  *size = lzf_compress (kpage, PGSIZE, data, CACHE_THRESHOLD, work);
+  if (*size == 0)
+    reject_cnt++;
+  lock_release (&compress_lock);
+
+  if (*size == 0)
+    {
+      free (data);
+      return NULL;
+    }
+  shrunk = realloc (data, *size);
+  return shrunk != NULL ? shrunk : data;
+}
@@ -0,0 +1,25 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct page;
+
+/* Returned by swap_out() when no slot is available, and used by
+   pages that have no slot. */
+#define SWAP_NONE SIZE_MAX
+
+/* Most bytes of compressed pages to keep in memory, or 0 to
+   write every page to the swap device. */
+extern size_t swap_cache_limit;
+
+void swap_init (void);
+size_t swap_out (const void *kpage, struct page *);
+void swap_in (size_t slot, void *kpage);
+void swap_dup (size_t slot);
+void swap_free (size_t slot, const struct page *);
+struct page *swap_owner (size_t slot, uint32_t *pagedir);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */